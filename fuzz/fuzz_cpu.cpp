@@ -0,0 +1,77 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+#include "cpu.h"
+#include "config.h"
+
+
+// Upper bound on the frames executed per input, keeps every run short.
+const int FUZZ_MAX_FRAMES = 64;
+
+
+/**
+ * @brief Run a random ROM with random inputs on the core. The input is laid
+ * out as:
+ *
+ *     [frames:1] [seed:4] [key mask:2 per frame] [ROM...]
+ *
+ * A bad ROM stops the machine with a fault, after which it idles. The core
+ * throws no exceptions, so any escaping one is a crash the fuzzer reports,
+ * like the out of bounds accesses and undefined behaviour the sanitizers
+ * catch.
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    static Chip8State state;
+
+    const size_t header_size = 1 + 4;
+    if (size < header_size) {
+        return 0;
+    }
+
+    int frame_count = 1 + data[0] % FUZZ_MAX_FRAMES;
+    uint32_t seed = data[1] | (data[2] << 8) | (data[3] << 16) | ((uint32_t) data[4] << 24);
+
+    const uint8_t* keys = data + header_size;
+    size_t key_bytes = std::min(size - header_size, (size_t) frame_count * 2);
+
+    const uint8_t* rom = keys + key_bytes;
+    size_t rom_size = std::min(size - header_size - key_bytes, (size_t) (MEMORY_SIZE - 0x200));
+
+    cpu_reset(state, seed);
+    cpu_load_rom(state, rom, rom_size);
+
+    for (int frame = 0; frame < frame_count && !state.fault; frame++) {
+        uint16_t key_mask = 0;
+        if ((size_t) frame * 2 + 1 < key_bytes) {
+            key_mask = keys[frame * 2] | (keys[frame * 2 + 1] << 8);
+        }
+
+        cpu_set_keys(state, key_mask);
+        cpu_execute_frame(state);
+    }
+
+    return 0;
+}
+
+#ifdef CHIP8_FUZZ_STANDALONE
+/**
+ * @brief Replay driver for compilers without libFuzzer: runs every file given
+ * on the command line through the harness once.
+ */
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        std::ifstream file(argv[i], std::ios_base::binary);
+        std::vector<uint8_t> input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        std::cout << "Running " << argv[i] << std::endl;
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+
+    return 0;
+}
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <map>
+#include <ostream>
+#include <set>
+#include <vector>
+
+#include "memory.h"
+
+
+/**
+ * @brief What a byte of memory is used for, as far as the static analysis can
+ * tell. Bytes that no path reaches are assumed to be data (sprites, tables).
+ */
+enum ByteKind {
+    BYTE_DATA,
+    BYTE_CODE,      // First byte of a reachable instruction
+    BYTE_OPERAND    // Second byte of a reachable instruction
+};
+
+/**
+ * @brief A straight run of instructions that is only entered at the top and
+ * only left at the bottom.
+ */
+struct BasicBlock {
+    uint16_t start;
+    uint16_t end;  // Address after the last instruction
+
+    // Blocks control can continue at. A call continues at the instruction
+    // after it, the subroutine is call_target.
+    std::vector<uint16_t> successors;
+
+    bool ends_with_call = false;
+    uint16_t call_target = 0;
+    bool ends_with_return = false;
+    bool ends_with_indirect_jump = false;  // BNNN, the target depends on V0
+};
+
+/**
+ * @brief The result of analyze_rom(): control flow graph and call graph of a
+ * program, found by following every jump, call, return and skip from the
+ * entry point.
+ */
+struct RomAnalysis {
+    uint16_t entry;
+    size_t rom_size;
+
+    std::vector<uint8_t> byte_kinds;  // A ByteKind per address
+    std::map<uint16_t, BasicBlock> blocks;
+
+    // Subroutine (or the entry point) to the subroutines it calls.
+    std::map<uint16_t, std::set<uint16_t>> calls;
+
+    // Addresses of BNNN instructions, their targets are unknown.
+    std::vector<uint16_t> indirect_jumps;
+};
+
+RomAnalysis analyze_rom(const Memory& memory, size_t rom_size, uint16_t entry = 0x200);
+void print_rom_analysis(const RomAnalysis& analysis, const Memory& memory, std::ostream& out);
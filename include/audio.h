@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+
+// Audio output format
+const int AUDIO_SAMPLE_RATE = 44100;
+
+// Amount of samples in one period of the wavetable, a power of two so the
+// phase accumulator can index it with a shift.
+const int WAVETABLE_BITS = 8;
+const int WAVETABLE_SIZE = 1 << WAVETABLE_BITS;
+
+
+/**
+ * @brief Generates the beep of the sound timer from a precomputed wavetable.
+ * The tone fades in and out over a few milliseconds when it is switched, so
+ * starting and stopping the beep does not click.
+ */
+class BeepGenerator {
+    int16_t m_wavetable[WAVETABLE_SIZE];
+
+    // Fixed point phase, the top WAVETABLE_BITS bits index the wavetable.
+    uint32_t m_phase = 0;
+    uint32_t m_phase_step;
+
+    // Envelope gain in 1/65536 units, moves towards 0 or 65536 by
+    // m_envelope_step per sample.
+    int32_t m_envelope = 0;
+    int32_t m_envelope_step;
+
+    public:
+        BeepGenerator(double tone_hz = 440, double amplitude = 500, double fade_ms = 5);
+
+        void generate(int16_t* buffer, int sample_count, bool playing);
+};
+
+/**
+ * @brief Turns the sound timer into audio driven by emulated time instead of
+ * host time. Every executed instruction adds its share of samples (one
+ * emulated 60Hz frame is exactly AUDIO_SAMPLE_RATE / 60 = 735 samples), with
+ * the beep on if the sound timer was running after that instruction. The
+ * output therefore only depends on the emulated program, so interactive,
+ * fast-forwarded and headless runs produce the same samples.
+ */
+class SoundRenderer {
+    BeepGenerator m_beep;
+
+    // Rendered samples that have not been taken yet.
+    std::vector<int16_t> m_samples;
+
+    uint64_t m_instruction_count = 0;
+    uint64_t m_sample_count = 0;
+
+    public:
+        void add_instruction(bool sound_on);
+        void add_silence(int sample_count);
+
+        const int16_t* samples() const { return m_samples.data(); }
+        size_t available() const { return m_samples.size(); }
+        void consume(size_t sample_count);
+
+        uint64_t total_samples() const { return m_sample_count; }
+};
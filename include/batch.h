@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <bitset>
+
+#include "cpu.h"
+#include "predecode.h"
+
+
+// Amount of lanes that are executed together, one 8bit register per lane fits
+// exactly in a 256bit AVX2 register.
+const int BATCH_GROUP_SIZE = 32;
+
+// Below this many lanes at the same instruction, a group runs on the scalar
+// path, which is cheaper for a handful of lanes.
+const int MIN_VECTOR_LANES = 4;
+
+// When the lanes of a group are at more different instructions than this,
+// they run the rest of the frame one by one instead of in lockstep.
+const int MAX_LOCKSTEP_INSTRUCTIONS = 8;
+
+/**
+ * @brief Pointers to the structure of arrays state of one group of lanes.
+ */
+struct BatchGroup {
+    uint8_t* registers[16];
+    uint16_t* index_register;
+    uint16_t* program_counter;
+    uint8_t* delay_timer;
+    uint8_t* sound_timer;
+
+    // Lanes whose machine faulted, they execute no more instructions.
+    uint32_t faulted_lanes = 0;
+};
+
+/**
+ * @brief Many instances of the same ROM executed in lockstep. The hot state
+ * (registers, index register, program counter and timers) is stored as a
+ * structure of arrays, so the lanes of a group that sit at the same PC
+ * execute the instruction at once with AVX2. Lanes that diverge from the
+ * others, and instructions without a vector version, run one by one on a
+ * scalar path that works on the same arrays. A group whose lanes are spread
+ * over many instructions leaves the lockstep until the end of the frame, and
+ * the lanes are sorted by PC before the next one.
+ */
+class Chip8Batch {
+    int m_lane_count;
+    int m_padded_lane_count;
+
+    // Structure of arrays, register r of lane l is at m_registers[r][l].
+    std::vector<uint8_t> m_registers[16];
+    std::vector<uint16_t> m_index_register;
+    std::vector<uint16_t> m_program_counter;
+    std::vector<uint8_t> m_delay_timer;
+    std::vector<uint8_t> m_sound_timer;
+
+    // The arrays of every group, they are never resized after construction.
+    std::vector<BatchGroup> m_groups;
+
+    // Every lane executes the same amount of instructions, so they share
+    // the timer accumulator.
+    float m_timer_accum = 0;
+
+    // The cold part of every lane: memory, screen, stack and keys.
+    std::vector<Chip8State> m_lanes;
+
+    // The arrays are reordered by PC when lanes drift apart, so lanes at the
+    // same point of the program share a group again. The lane numbers of the
+    // public interface map to positions in the arrays through these.
+    std::vector<int> m_position_of_lane;
+    std::vector<int> m_lane_at_position;
+    bool m_regroup = false;
+
+    // Decoded instructions, shared by all lanes.
+    PredecodeCache m_cache;
+
+    // Addresses any lane wrote to. Everywhere else all lanes still have the
+    // bytes of the ROM they were forked from.
+    std::bitset<MEMORY_SIZE> m_written;
+
+    bool m_use_avx2;
+
+    // Statistics, in lane steps
+    uint64_t m_vector_steps = 0;
+    uint64_t m_scalar_steps = 0;
+
+    void store_lane(int lane);
+    void execute_lanes(int first_lane, uint32_t lanes, Instruction instr);
+
+    int step_group(int first_lane);
+    void run_lane(int lane, int first_step, const int* decrement_counts);
+    bool step_group_vector(int first_lane, Instruction instr, uint32_t lanes);
+    uint32_t lanes_at_pc(int first_lane, uint16_t pc) const;
+    void update_clocks(int first_lane, int count, int decrement_count);
+    void regroup();
+
+    public:
+        Chip8Batch(int lane_count, const uint8_t* rom, size_t rom_size, uint32_t seed = 1);
+
+        // The groups point into the arrays.
+        Chip8Batch(const Chip8Batch&) = delete;
+        Chip8Batch& operator=(const Chip8Batch&) = delete;
+
+        void step();
+        void run_frame();
+
+        void set_keys(int lane, uint16_t key_mask);
+        Chip8State get_lane(int lane) const;
+
+        int lane_count() const { return m_lane_count; }
+        bool using_avx2() const { return m_use_avx2; }
+
+        uint64_t vector_steps() const { return m_vector_steps; }
+        uint64_t scalar_steps() const { return m_scalar_steps; }
+};
+
+int run_batch_benchmark(const char* rom_path, int lane_count, int frame_count);
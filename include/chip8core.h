@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+
+#include "cpu.h"
+
+class SoundRenderer;
+
+
+/**
+ * @brief A single emulated machine, the entry point of the chip8core library
+ * for programs that just run ROMs (headless tools, benchmarks, fuzzers).
+ * Wraps a Chip8State and the cpu_* functions, state() gives access to the
+ * rest of the core.
+ *
+ * A ROM that over- or underflows the stack stops the machine, fault() tells
+ * why. It stays stopped until reset().
+ */
+class Chip8 {
+    // Behind a pointer so state() stays valid when a Chip8 is moved.
+    std::unique_ptr<Chip8State> m_state;
+
+    public:
+        Chip8(uint32_t seed = 1, Quirks quirks = Quirks());
+
+        void reset(uint32_t seed = 1);
+        bool load_rom(const uint8_t* data, size_t size);
+
+        void step(uint64_t count = 1);
+        void run_frames(uint64_t count = 1, SoundRenderer* sound = nullptr);
+
+        void set_key(int key, bool pressed);
+        void set_keys(uint16_t key_mask);
+
+        /**
+         * @brief The framebuffer, 32 rows of 64 pixels with the most
+         * significant bit as the leftmost pixel.
+         */
+        const uint64_t* framebuffer() const { return m_state->pixel_buffer; }
+        bool pixel(int x, int y) const { return get_pixel(*m_state, x, y); }
+        uint64_t framebuffer_hash() const { return cpu_framebuffer_hash(*m_state); }
+
+        CpuFault fault() const { return m_state->fault; }
+
+        Chip8State& state() { return *m_state; }
+        const Chip8State& state() const { return *m_state; }
+};
@@ -3,3 +3,6 @@
 // Timing
 const float TIMER_FREQ = 60.f;
 const int INSTR_PER_FRAME = 30;
+
+// Audio
+const int AUDIO_BUFFER_SAMPLES = 512;  // Device buffer size, ~12ms at 44.1kHz
@@ -1,12 +1,19 @@
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+
+#include "memory.h"
+
+class SoundRenderer;
+
 
 /**
  * @brief An enum to identify each instruction easily. Also provides an enum
  * for undefined opcodes if necessary.
  *
  */
-enum Opcode {
+enum Opcode : uint8_t {
     OP_EXEC_ROUTINE,
     OP_CLEAR_SCREEN,
     OP_JUMP_SUBR,
@@ -47,50 +54,130 @@ enum Opcode {
     OP_UNDEFINED
 };
 
+/**
+ * @brief A simple data type to store instructions. It stores the instruction
+ * identifier provided by an enum and the raw instruction bytes, the arguments
+ * are extracted from those on demand. Four bytes, so it is passed in a
+ * register and a cache of decoded instructions stays small.
+ */
 struct Instruction {
     Opcode op_id;
+    uint16_t raw;
 
-    // Store the values in the instruction context.
-    uint16_t nnn;
-    uint8_t nn;
-    uint8_t n;
+    uint16_t nnn() const { return raw & 0x0FFF; }
+    uint8_t nn() const { return raw & 0x00FF; }
+    uint8_t n() const { return raw & 0x000F; }
 
-    uint8_t x;
-    uint8_t y;
+    uint8_t x() const { return (raw & 0x0F00) >> 8; }
+    uint8_t y() const { return (raw & 0x00F0) >> 4; }
 };
 
+static_assert(sizeof(Instruction) == 4, "Instruction must stay packed in 4 bytes");
+
+typedef struct Instruction Instruction;
 
 /**
- * @brief A simple data type to store instructions. It stores the instruction
- * identifier provided by an enum. It also stores all possible arguments that
- * could be used by the instruction.
+ * @brief Behaviour that differs between CHIP8 implementations.
  */
-typedef struct Instruction Instruction;
+struct Quirks {
+    // Sprites crossing the edge of the screen wrap around to the other side
+    // instead of being clipped.
+    bool wrap_sprites = false;
+};
 
-// Inputs
-extern bool keys_pressed[16];
-extern bool keys_released[16];
+/**
+ * @brief Why a machine stopped executing instructions.
+ */
+enum CpuFault : uint8_t {
+    FAULT_NONE,
+    FAULT_STACK_OVERFLOW,   // CALL with 16 return addresses on the stack
+    FAULT_STACK_UNDERFLOW   // RET with an empty stack
+};
+
+/**
+ * @brief The complete state of a single CHIP8 machine. Every CPU method and
+ * opcode handler operates on one of these, so multiple emulator instances can
+ * run side by side (e.g. one per thread).
+ *
+ * Copying a state forks the machine: memory pages are shared copy-on-write,
+ * everything else is small enough to copy outright.
+ */
+struct Chip8State {
+    // Inputs
+    bool keys_pressed[16];
+    bool keys_released[16];
 
-// Graphics
-extern bool pixel_buffer[32][64];
+    // Graphics, one bit per pixel. The most significant bit of a row is the
+    // leftmost pixel.
+    uint64_t pixel_buffer[32];
 
-// Registers
-extern uint16_t index_register;
-extern uint8_t registers[16];
-extern uint16_t program_counter;
-extern uint8_t stack_pointer;
+    // Memory
+    Memory memory;
 
-// Timers
-extern uint8_t delay_timer;
-extern uint8_t sound_timer;
+    // Registers
+    uint16_t index_register;
+    uint8_t registers[16];
+    uint16_t program_counter;
+    uint8_t stack_pointer;
 
-// Stack
-extern uint16_t stack[16];
+    // Timers
+    uint8_t delay_timer;
+    uint8_t sound_timer;
 
-void load_fonts();
+    float timer_accum;
+
+    // Stack
+    uint16_t stack[16];
+
+    // State of the random number generator used by CXNN, seeded per instance
+    // so runs are reproducible.
+    uint32_t rng_state;
+
+    Quirks quirks;
+
+    // Set when the ROM did something the machine can't continue from. A
+    // faulted machine executes no more instructions until it is reset, its
+    // timers keep running. The PC is past the faulting instruction.
+    CpuFault fault;
+
+    Chip8State fork() const;
+};
+
+/**
+ * @brief Check if the pixel at (x, y) is on.
+ */
+inline bool get_pixel(const Chip8State& state, int x, int y) {
+    return (state.pixel_buffer[y] >> (63 - x)) & 0b1;
+}
+
+/**
+ * @brief Address of the instruction a faulted machine stopped at.
+ */
+inline uint16_t cpu_fault_address(const Chip8State& state) {
+    return (state.program_counter - 2) & ADDRESS_MASK;
+}
+
+void load_fonts(Chip8State& state);
+
+// Instance management
+void cpu_reset(Chip8State& state, uint32_t seed = 1);
+bool cpu_load_rom(Chip8State& state, const uint8_t* data, size_t size, uint16_t offset = 0x200);
+void cpu_set_keys(Chip8State& state, uint16_t key_mask);
 
 // CPU methods
-void push_stack(uint16_t val);
-uint16_t pop_stack();
+bool push_stack(Chip8State& state, uint16_t val);
+bool pop_stack(Chip8State& state, uint16_t& val);
+uint8_t cpu_random(Chip8State& state);
+
+uint16_t fetch(Chip8State& state);
+Instruction decode(uint16_t instr_bytes);
+void execute(Chip8State& state, Instruction instr);
+
+int advance_timer_accum(float& timer_accum, double time_delta_ms);
+void update_clocks(Chip8State& state, double time_delta_ms);
+
+void cpu_execute_instruction(Chip8State& state);
+void cpu_execute_frame(Chip8State& state, SoundRenderer* sound = nullptr);
 
-void cpu_execute_instruction();
+uint64_t cpu_framebuffer_hash(const Chip8State& state);
+const char* cpu_fault_name(CpuFault fault);
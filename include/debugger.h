@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "cpu.h"
+#include "memory.h"
+
+class SoundRenderer;
+
+
+/**
+ * @brief What a watchpoint looks at.
+ */
+enum WatchTarget {
+    WATCH_MEMORY,    // The byte at an address
+    WATCH_REGISTER,  // One of V0-VF
+    WATCH_INDEX      // The index register
+};
+
+/**
+ * @brief Stops the machine after an instruction changed the watched value.
+ */
+struct Watchpoint {
+    WatchTarget target;
+    uint16_t address;  // Memory address or register number
+
+    uint16_t last_value;
+};
+
+/**
+ * @brief Why debug_run() stopped.
+ */
+enum BreakReason {
+    BREAK_NONE,     // Executed everything it was asked to
+    BREAK_PC,       // The next instruction has a breakpoint
+    BREAK_OPCODE,   // The next instruction is of a watched opcode class
+    BREAK_WATCH,    // The last instruction changed a watched value
+    BREAK_FAULT     // The last instruction faulted the machine
+};
+
+/**
+ * @brief All breakpoints and watchpoints of a debugging session.
+ *
+ * PC breakpoints are one bit per address, so checking one is a shift and an
+ * AND no matter how many are set. Opcode class breakpoints are one bit per
+ * Opcode.
+ */
+struct Breakpoints {
+    uint64_t pc_bitmap[MEMORY_SIZE / 64] = {};
+    int pc_count = 0;
+
+    uint64_t opcode_classes = 0;
+
+    std::vector<Watchpoint> watchpoints;
+};
+
+static_assert(OP_UNDEFINED < 64, "Opcode classes must fit in a 64bit mask");
+
+/**
+ * @brief Check if there is a breakpoint at an address.
+ */
+inline bool breakpoint_at(const Breakpoints& breakpoints, uint16_t address) {
+    address &= ADDRESS_MASK;
+
+    return (breakpoints.pc_bitmap[address / 64] >> (address % 64)) & 1;
+}
+
+/**
+ * @brief Check if anything would stop the machine. If not, the normal
+ * execution loop can be used without any checks.
+ */
+inline bool breakpoints_active(const Breakpoints& breakpoints) {
+    return breakpoints.pc_count > 0 || breakpoints.opcode_classes != 0 || !breakpoints.watchpoints.empty();
+}
+
+void breakpoint_set(Breakpoints& breakpoints, uint16_t address, bool enabled);
+void breakpoint_set_opcode(Breakpoints& breakpoints, Opcode op_id, bool enabled);
+void breakpoints_merge(Breakpoints& into, const Breakpoints& from);
+void watchpoint_add(Breakpoints& breakpoints, const Chip8State& state, WatchTarget target, uint16_t address);
+
+BreakReason breakpoint_hit(const Breakpoints& breakpoints, const Chip8State& state);
+
+uint64_t decoded_opcode_classes();
+const char* opcode_class_name(Opcode op_id);
+const char* break_reason_name(BreakReason reason);
+
+/**
+ * @brief Result of debug_run().
+ */
+struct DebugRunResult {
+    int executed;
+    BreakReason reason;
+};
+
+DebugRunResult debug_run(Chip8State& state, Breakpoints& breakpoints, int count, bool resume, SoundRenderer* sound = nullptr);
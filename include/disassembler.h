@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "cpu.h"
+#include "memory.h"
+
+
+std::string disassemble(Instruction instr);
+
+
+/**
+ * @brief Disassembly of the whole address space, decoded lazily. Every
+ * address keeps the text of the instruction starting there together with the
+ * two bytes it was decoded from; a line is only decoded again once those
+ * bytes change (self-modifying code, a new ROM), so showing a listing costs a
+ * two byte compare per visible line.
+ */
+class Disassembler {
+    struct Line {
+        uint16_t raw;
+        bool valid = false;
+        std::string text;
+    };
+
+    std::vector<Line> m_lines;
+
+    public:
+        Disassembler() : m_lines(MEMORY_SIZE) {}
+
+        const std::string& line(const Memory& memory, uint16_t address);
+};
@@ -1,33 +1,133 @@
 #pragma once
 
+#include <string>
 #include <SDL.h>
 
+#include "cpu.h"
+#include "audio.h"
+#include "config.h"
+#include "wav_writer.h"
+#include "video_recorder.h"
+#include "phosphor.h"
+#include "profiler.h"
+#include "disassembler.h"
+#include "debugger.h"
+#include "rewind.h"
+#include "analysis.h"
+
+/**
+ * @brief How the emulator loop is kept at 60 frames per second.
+ */
+enum PacingMode {
+    PACING_AUTO,   // vsync if the display runs at about 60Hz, else the timer
+    PACING_VSYNC,  // SDL_RenderPresent() blocks until the next refresh
+    PACING_TIMER   // high resolution clock, sleep and then spin
+};
+
+const int FRAME_TIME_HISTORY = 120;
+
+/**
+ * @brief Stages of the main loop that are timed for the Performance window.
+ */
+enum PerfStage {
+    PERF_EMULATION,
+    PERF_GUI_LAYOUT,
+    PERF_RENDER,
+    PERF_PRESENT,
+    PERF_AUDIO,
+    PERF_STAGE_COUNT
+};
+
 class GUI {
     // SDL objects
     SDL_Texture* m_chip8_texture;
     SDL_Window* m_window;
     SDL_Renderer* m_renderer;
 
+    // Layout, recomputed by update_layout() when the window size changes
+    int m_layout_width = 0;
+    int m_layout_height = 0;
+    SDL_Rect m_screen_rect = {0, 0, 0, 0};
+
+    // Afterglow of the last frames against flicker
+    PhosphorFilter m_phosphor;
+
+    // The emulated machine, owned by the caller of start_gui()
+    Chip8State* m_state = nullptr;
+
+    // Audio
+    SDL_AudioDeviceID m_audio_device = 0;
+    int m_audio_buffer_samples = AUDIO_BUFFER_SAMPLES;
+    SoundRenderer m_sound;
+    std::string m_audio_capture_path;
+    WavWriter m_audio_capture;
+
+    // Video
+    std::string m_video_capture_path;
+    VideoRecorder m_video_capture;
+
+    // Frame pacing
+    PacingMode m_pacing = PACING_AUTO;
+    bool m_vsync = false;
+    int m_display_refresh_rate = 0;
+    float m_frame_times[FRAME_TIME_HISTORY] = {};  // ms, ring buffer
+    int m_frame_time_index = 0;
+
+    // Telemetry of the main loop stages
+    StageTimings m_perf[PERF_STAGE_COUNT];
+
+    // Debugger
+    Disassembler m_disassembler;
+    bool m_follow_pc = true;
+    uint16_t m_listing_pc = 0xFFFF;  // PC the listing was last scrolled to
+    RomAnalysis m_analysis;  // Empty if no analysis was given
+    Breakpoints m_breakpoints;
+    BreakReason m_break_reason = BREAK_NONE;
+    bool m_resume = false;  // Run the current instruction even if it has a breakpoint
+    uint16_t m_breakpoint_input = 0x200;
+    uint8_t m_watch_register_input = 0;
+    RewindHistory m_rewind;
+
+    // Run command from the controls, executed by run_command()
+    bool m_run_pending = false;
+    uint64_t m_run_limit = 0;
+    Breakpoints m_run_stops;
+    uint32_t m_run_count_input = 1000;
+    uint16_t m_run_until_input = 0x200;
+
     // State
     bool running = true;
     bool run_fast = false;
     bool execute_next = false;
 
     public:
-        void start_gui();
+        void start_gui(Chip8State& state);
         void setup_audio();
+        void set_audio_buffer_size(int samples);
+        void set_audio_capture(std::string path);
+        void set_video_capture(std::string path);
+        void set_pacing(PacingMode pacing);
+        void set_rom_analysis(RomAnalysis analysis);
+        void queue_audio();
         void setup_GUI();
         void close_GUI();
 
         void run_emulator();
+        void request_run(uint64_t limit, const Breakpoints& stops);
+        void run_command();
 
+        void update_layout();
         void render();
         void write_CHIP8_buffer();
         void render_gui_controls();
         void render_gui_cpu();
         void render_gui_memory();
+        void render_gui_pacing();
+        void render_gui_performance();
+        void render_gui_disassembly();
+        void render_gui_breakpoints();
 
         uint8_t translate_sdl_to_scancode(SDL_Scancode scancode);
-        void sync_with_clock(double frame_duration);
+        void sync_with_clock(uint64_t& deadline);
         void handle_key_events();
 };
\ No newline at end of file
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include "cpu.h"
+
+
+/**
+ * @brief Settings of a headless run: a single ROM without a window or audio
+ * device, executed as fast as possible.
+ */
+struct HeadlessOptions {
+    std::string rom_path;
+    uint64_t frames = 600;
+    uint32_t seed = 1;
+    Quirks quirks;
+
+    // Optional outputs, empty if not wanted.
+    std::string audio_out;
+    std::string video_out;
+    // Per frame framebuffer hashes, one per line, "-" for stdout.
+    std::string hash_out;
+};
+
+int run_headless(const HeadlessOptions& options);
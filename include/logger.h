@@ -1,9 +1,29 @@
 #pragma once
 
 #include <string>
+#include <format>
+#include <utility>
+
+extern bool logging_enabled;
 
 void open_log_file();
 void close_log_file();
 
-void log_info(std::string msg);
+void write_log(const std::string& msg);
 void log_err(std::string msg);
+
+/**
+ * @brief Log informative messages to the desired output. The message is only
+ * formatted when logging is enabled, so calling this from the hot CPU loop is
+ * cheap when it is turned off.
+ *
+ * @param fmt The format string of the message.
+ * @param args The arguments to format into the message.
+ */
+template <typename... Args>
+inline void log_info(std::format_string<Args...> fmt, Args&&... args) {
+    if (!logging_enabled)
+        return;
+
+    write_log(std::format(fmt, std::forward<Args>(args)...));
+}
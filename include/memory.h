@@ -1,4 +1,64 @@
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+
+// The size of the address space: 4096 for CHIP8, 65536 for XO-CHIP. It has to
+// be a power of two, addresses are masked to it on every access.
+#ifndef CHIP8_MEMORY_SIZE
+#define CHIP8_MEMORY_SIZE 4096
+#endif
+
 // Memory
-extern uint8_t memory[4096];
+const int MEMORY_SIZE = CHIP8_MEMORY_SIZE;
+const uint16_t ADDRESS_MASK = MEMORY_SIZE - 1;
+
+static_assert(MEMORY_SIZE >= 4096 && MEMORY_SIZE <= 65536 && (MEMORY_SIZE & (MEMORY_SIZE - 1)) == 0,
+    "CHIP8_MEMORY_SIZE must be a power of two between 4096 and 65536");
+
+// Memory is split in pages which are shared between forked machines until one
+// of them writes to it.
+const int MEMORY_PAGE_SIZE = 256;
+const int MEMORY_PAGE_COUNT = MEMORY_SIZE / MEMORY_PAGE_SIZE;
+
+
+/**
+ * @brief The memory of a CHIP8 machine, split in reference counted
+ * copy-on-write pages. Copying a Memory only copies the page references, a
+ * page is duplicated the first time one of the copies writes to it. Reads are
+ * done through operator[], writes must go through write().
+ *
+ * Every address is masked to the size of the address space, so accesses past
+ * the end wrap around instead of running out of bounds. The mask is a
+ * constant, which makes it a single AND (or nothing at all for 64K).
+ */
+class Memory {
+    struct Page {
+        uint8_t bytes[MEMORY_PAGE_SIZE];
+    };
+
+    std::shared_ptr<Page> m_pages[MEMORY_PAGE_COUNT];
+
+    uint8_t* writable_page(int page_index);
+
+    public:
+        Memory();
+
+        uint8_t operator[](uint16_t address) const {
+            address &= ADDRESS_MASK;
+
+            return m_pages[address / MEMORY_PAGE_SIZE]->bytes[address % MEMORY_PAGE_SIZE];
+        }
+
+        void write(uint16_t address, uint8_t val) {
+            address &= ADDRESS_MASK;
+
+            writable_page(address / MEMORY_PAGE_SIZE)[address % MEMORY_PAGE_SIZE] = val;
+        }
+
+        void write_block(uint16_t address, const uint8_t* data, size_t size);
+        void clear();
+
+        bool shares_page(const Memory& other, int page_index) const;
+};
@@ -3,54 +3,64 @@
 #include "cpu.h"
 
 // starts with 0x0...
-void opcode_execute_routine(Instruction instr);
-void opcode_clear_screen(Instruction instr);
-void opcode_jump_subr(Instruction instr);
+void opcode_execute_routine(Chip8State& state, Instruction instr);
+void opcode_clear_screen(Chip8State& state, Instruction instr);
+void opcode_jump_subr(Chip8State& state, Instruction instr);
 
-void opcode_jump_address(Instruction instr);
+void opcode_jump_address(Chip8State& state, Instruction instr);
 
-void opcode_return(Instruction instr);
-void opcode_call_subr(Instruction instr);
+void opcode_return(Chip8State& state, Instruction instr);
+void opcode_call_subr(Chip8State& state, Instruction instr);
 
-void opcode_skip_val_eq(Instruction instr);
-void opcode_skip_val_neq(Instruction instr);
+void opcode_skip_val_eq(Chip8State& state, Instruction instr);
+void opcode_skip_val_neq(Chip8State& state, Instruction instr);
 
-void opcode_skip_reg_eq(Instruction instr);
-void opcode_skip_reg_neq(Instruction instr);
+void opcode_skip_reg_eq(Chip8State& state, Instruction instr);
+void opcode_skip_reg_neq(Chip8State& state, Instruction instr);
 
-void opcode_set_x(Instruction instr);
-void opcode_add_x(Instruction instr);
+void opcode_set_x(Chip8State& state, Instruction instr);
+void opcode_add_x(Chip8State& state, Instruction instr);
 
 // 0x8...
-void opcode_add_x_to_y(Instruction instr);
-void opcode_set_x_y(Instruction instr);
-void opcode_or(Instruction instr);
-void opcode_and(Instruction instr);
-void opcode_xor(Instruction instr);
-void opcode_add_y_to_x(Instruction instr);
-void opcode_sub_y_from_x(Instruction instr);
-void opcode_sub_x_from_y(Instruction instr);
-void opcode_shift_right(Instruction instr);
-void opcode_shift_left(Instruction instr);
+void opcode_add_x_to_y(Chip8State& state, Instruction instr);
+void opcode_set_x_y(Chip8State& state, Instruction instr);
+void opcode_or(Chip8State& state, Instruction instr);
+void opcode_and(Chip8State& state, Instruction instr);
+void opcode_xor(Chip8State& state, Instruction instr);
+void opcode_add_y_to_x(Chip8State& state, Instruction instr);
+void opcode_sub_y_from_x(Chip8State& state, Instruction instr);
+void opcode_sub_x_from_y(Chip8State& state, Instruction instr);
+void opcode_shift_right(Chip8State& state, Instruction instr);
+void opcode_shift_left(Chip8State& state, Instruction instr);
 
-void opcode_set_index(Instruction instr);
+void opcode_set_index(Chip8State& state, Instruction instr);
 
-void opcode_jump_offset(Instruction instr);
+void opcode_jump_offset(Chip8State& state, Instruction instr);
 
-void opcode_set_x_random(Instruction instr);
+void opcode_set_x_random(Chip8State& state, Instruction instr);
 
-void opcode_draw(Instruction instr);
+void opcode_draw(Chip8State& state, Instruction instr);
+bool draw_sprite(Chip8State& state, uint8_t x, uint8_t y, uint16_t sprite_addr, uint8_t height);
 
-void opcode_skip_kp(Instruction instr);
-void opcode_skip_not_kp(Instruction instr);
+void opcode_skip_kp(Chip8State& state, Instruction instr);
+void opcode_skip_not_kp(Chip8State& state, Instruction instr);
 
 // 0xF...
-void opcode_set_x_to_delay(Instruction instr);
-void opcode_wait_keypress(Instruction instr);
-void opcode_set_delay_to_x(Instruction instr);
-void opcode_set_sound_to_x(Instruction instr);
-void opcode_add_x_to_index(Instruction instr);
-void opcode_set_index_sprite(Instruction instr);
-void opcode_write_bcd(Instruction instr);
-void opcode_write_regs(Instruction instr);
-void opcode_read_regs(Instruction instr);
+void opcode_set_x_to_delay(Chip8State& state, Instruction instr);
+void opcode_wait_keypress(Chip8State& state, Instruction instr);
+void opcode_set_delay_to_x(Chip8State& state, Instruction instr);
+void opcode_set_sound_to_x(Chip8State& state, Instruction instr);
+void opcode_add_x_to_index(Chip8State& state, Instruction instr);
+void opcode_set_index_sprite(Chip8State& state, Instruction instr);
+void opcode_write_bcd(Chip8State& state, Instruction instr);
+void opcode_write_regs(Chip8State& state, Instruction instr);
+void opcode_read_regs(Chip8State& state, Instruction instr);
+
+// Specialised 8XYN handlers, see opcodes_specialized.cpp
+#ifndef CHIP8_SPECIALIZED_ALU
+#define CHIP8_SPECIALIZED_ALU 0
+#endif
+
+typedef void (*OpcodeHandler)(Chip8State& state, Instruction instr);
+
+OpcodeHandler specialized_alu_handler(uint16_t instr_bytes);
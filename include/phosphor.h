@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+const int PHOSPHOR_MAX_FRAMES = 8;
+
+
+/**
+ * @brief Simulates the afterglow of a phosphor screen to hide the flicker of
+ * sprites that are erased and redrawn every frame. A pixel that was lit in
+ * one of the last `frames` emulated frames is drawn in a mix of the on and
+ * off colors, fading by `decay` for every frame it has been off.
+ *
+ * All work is done on the packed framebuffers (64 pixels per word), only the
+ * final expansion to the texture touches single pixels.
+ */
+struct PhosphorFilter {
+    int frames = 1;  // 1 disables the filter
+    float decay = 0.5f;
+
+    // Ring buffer of the last frames, newest at `newest`.
+    uint64_t history[PHOSPHOR_MAX_FRAMES][32] = {};
+    int newest = 0;
+};
+
+void phosphor_push(PhosphorFilter& filter, const uint64_t rows[32]);
+void phosphor_expand(const PhosphorFilter& filter, uint32_t on_color, uint32_t off_color, uint32_t* colors);
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "cpu.h"
+#include "memory.h"
+#include "opcodes.h"
+
+class SoundRenderer;
+
+
+/**
+ * @brief Frequent instruction sequences that are executed by a single
+ * handler instead of one dispatch per instruction.
+ */
+enum Superinstruction : uint8_t {
+    SUPER_NONE,
+    SUPER_DELAY_WAIT,  // FX07; 3XNN; 1NNN, waiting for the delay timer
+    SUPER_LOAD_DRAW,   // 6XNN; 6YNN; DXYN, drawing at fixed coordinates
+    SUPER_COUNTER      // 7XNN; 3XNN or 4XNN, counting a loop
+};
+
+/**
+ * @brief The decoded instruction at an address, or the decoded sequence if a
+ * superinstruction starts there. The instructions keep the raw words they
+ * were decoded from to detect that the memory changed.
+ */
+struct PredecodedEntry {
+    Superinstruction super = SUPER_NONE;
+    uint8_t length = 0;  // Amount of instructions, 0 if not decoded yet
+
+    Instruction instr[3];
+
+    // Handler specialised for a single instruction, nullptr to use execute()
+    OpcodeHandler handler = nullptr;
+};
+
+/**
+ * @brief Decoded instructions per address, so the decoding is only done
+ * again when the memory at an address changes. Entries are checked against
+ * the memory on every lookup, which makes the cache valid for any machine:
+ * it can be shared between machines, e.g. one per thread.
+ */
+class PredecodeCache {
+    std::vector<PredecodedEntry> m_entries;
+
+    public:
+        PredecodeCache() : m_entries(MEMORY_SIZE) {}
+
+        const PredecodedEntry& lookup(const Memory& memory, uint16_t address);
+};
+
+int cpu_execute_predecoded(Chip8State& state, PredecodeCache& cache, int budget, SoundRenderer* sound = nullptr);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <chrono>
+
+const int PROFILE_HISTORY = 240;  // Samples kept per stage, 4 seconds at 60fps
+
+
+/**
+ * @brief Rolling history of how long one stage of the main loop took.
+ */
+struct StageTimings {
+    const char* name = "";
+    float samples[PROFILE_HISTORY] = {};  // Microseconds, ring buffer
+    int next = 0;
+    int count = 0;
+};
+
+void stage_add_sample(StageTimings& stage, float microseconds);
+float stage_percentile(const StageTimings& stage, float percentile);
+
+
+/**
+ * @brief Measures the time until it goes out of scope and adds it to a stage.
+ */
+class ScopedTimer {
+    StageTimings& m_stage;
+    std::chrono::steady_clock::time_point m_start;
+
+    public:
+        ScopedTimer(StageTimings& stage) : m_stage(stage), m_start(std::chrono::steady_clock::now()) {}
+
+        ~ScopedTimer() {
+            std::chrono::duration<float, std::micro> elapsed = std::chrono::steady_clock::now() - m_start;
+            stage_add_sample(m_stage, elapsed.count());
+        }
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+
+#include "cpu.h"
+#include "debugger.h"
+
+
+/**
+ * @brief History of a running machine that allows stepping backwards.
+ *
+ * Instead of saving the machine after every instruction, a snapshot (a cheap
+ * copy-on-write fork) is taken every `interval` instructions and the key
+ * state is logged whenever it changes. Since the machine is deterministic
+ * (seeded random numbers, emulated timers), any earlier instruction can be
+ * reached again by restoring the nearest snapshot before it and executing
+ * forward with the logged keys. The amount of snapshots is bounded, the
+ * oldest ones are dropped.
+ *
+ * The owner calls begin_batch() before and executed() after executing
+ * instructions on the machine.
+ */
+class RewindHistory {
+    struct Snapshot {
+        uint64_t instruction;
+        Chip8State state;
+    };
+
+    struct InputChange {
+        uint64_t instruction;
+        bool keys_pressed[16];
+        bool keys_released[16];
+    };
+
+    std::deque<Snapshot> m_snapshots;
+    std::deque<InputChange> m_inputs;
+
+    uint64_t m_instruction = 0;  // Instructions executed since the first snapshot
+    uint64_t m_interval;
+    size_t m_max_snapshots;
+
+    bool replay(const Snapshot& snapshot, uint64_t target, Chip8State& state,
+        const Breakpoints* breakpoints = nullptr, uint64_t* last_hit = nullptr) const;
+    void truncate(uint64_t instruction);
+
+    public:
+        RewindHistory(uint64_t interval = 300, size_t max_snapshots = 600)
+            : m_interval(interval), m_max_snapshots(max_snapshots) {}
+
+        void begin_batch(const Chip8State& state);
+        void executed(int count) { m_instruction += count; }
+
+        uint64_t position() const { return m_instruction; }
+        uint64_t oldest() const { return m_snapshots.empty() ? m_instruction : m_snapshots.front().instruction; }
+
+        bool step_back(Chip8State& state, uint64_t count = 1);
+        bool run_back(Chip8State& state, const Breakpoints& breakpoints);
+};
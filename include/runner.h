@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "cpu.h"
+
+
+/**
+ * @brief A single entry of the input movie: from the given frame on, the keys
+ * set in key_mask (bit N is key N) are held down.
+ */
+struct MovieEntry {
+    uint64_t frame;
+    uint16_t key_mask;
+};
+
+/**
+ * @brief One independent emulator run of a test matrix.
+ */
+struct RunnerJob {
+    std::string rom_path;
+    uint64_t frames = 0;
+    uint32_t seed = 1;
+
+    // Optional, empty if no keys are pressed during the run.
+    std::string movie_path;
+
+    Quirks quirks;
+};
+
+/**
+ * @brief The outcome of a single job.
+ */
+struct RunnerResult {
+    bool ok = false;
+    std::string error;
+
+    uint64_t framebuffer_hash = 0;
+    uint64_t cycles_executed = 0;
+    double wall_time_ms = 0;
+};
+
+bool read_binary_file(const std::string& path, std::vector<uint8_t>& data);
+bool parse_number(const char* text, uint64_t min, uint64_t max, uint64_t& value);
+bool parse_seed(const char* text, uint32_t& seed);
+
+std::vector<RunnerJob> read_job_list(const std::string& path);
+std::vector<MovieEntry> read_movie(const std::string& path);
+
+RunnerResult run_job(const RunnerJob& job, const std::vector<uint8_t>& rom, const std::vector<MovieEntry>& movie);
+std::vector<RunnerResult> run_jobs(const std::vector<RunnerJob>& jobs, int thread_count = 0);
+
+void print_job_results(const std::vector<RunnerJob>& jobs, const std::vector<RunnerResult>& results);
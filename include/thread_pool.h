@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/**
+ * @brief A fixed-size work-stealing thread pool. Every worker owns a task
+ * queue; it takes work from the back of its own queue and, once that runs
+ * dry, steals from the front of the other workers' queues. This keeps all
+ * cores busy when tasks have very different run times.
+ */
+class ThreadPool {
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+    std::vector<std::thread> m_workers;
+
+    // Tasks waiting in a queue, and tasks that have not finished yet.
+    std::atomic<int> m_queued = 0;
+    std::atomic<int> m_unfinished = 0;
+    std::atomic<unsigned> m_next_queue = 0;
+
+    // Used to put idle workers (and wait()) to sleep.
+    std::mutex m_mutex;
+    std::condition_variable m_work_available;
+    std::condition_variable m_all_done;
+    bool m_stopping = false;
+
+    bool try_pop(int worker_index, std::function<void()>& task);
+    void worker_loop(int worker_index);
+
+    public:
+        explicit ThreadPool(int thread_count = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        void submit(std::function<void()> task);
+        void wait();
+
+        int thread_count() const { return (int) m_workers.size(); }
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+
+/**
+ * @brief Records the CHIP8 screen losslessly, one picture per emulated frame.
+ *
+ * Two formats are supported, chosen by the file extension:
+ * - ".y4m": YUV4MPEG2 with a monochrome 64x32 luma plane at 60 fps, readable
+ *   by ffmpeg and most players.
+ * - anything else: a packed 1 bit per pixel stream. It starts with the line
+ *   "CHIP8VIDEO 64 32 60\n", followed by records of either 'F' and the 256
+ *   bytes of a frame (rows top to bottom, leftmost pixel in the most
+ *   significant bit), or 'R' and a little endian uint32 count of times the
+ *   previous frame repeats.
+ *
+ * Identical consecutive frames are only counted on the emulation thread, all
+ * conversion and file writing happens on a background thread.
+ */
+class VideoRecorder {
+    struct Record {
+        // Times the previous frame repeats before this one.
+        uint32_t repeat_count;
+        uint64_t rows[32];
+    };
+
+    std::ofstream m_file;
+    bool m_y4m = false;
+
+    // Last frame handed to the writer, used to detect repeats.
+    uint64_t m_last_rows[32];
+    bool m_has_frame = false;
+    uint32_t m_repeat_count = 0;
+
+    // Queue between the emulation thread and the writer thread.
+    std::deque<Record> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_queue_changed;
+    bool m_stopping = false;
+    std::thread m_writer;
+
+    // Only used by the writer thread.
+    uint8_t m_last_luma[64 * 32];
+
+    void writer_loop();
+    void write_record(const Record& record);
+    void write_repeats(uint32_t repeat_count);
+
+    public:
+        ~VideoRecorder();
+
+        bool open(const std::string& path);
+        void add_frame(const uint64_t pixel_buffer[32]);
+        void close();
+
+        bool is_open() const { return m_writer.joinable(); }
+};
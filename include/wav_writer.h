@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+
+// Samples collected before they are written to disk in one go.
+const size_t WAV_CHUNK_SAMPLES = 1 << 16;
+
+/**
+ * @brief Streams 16bit mono audio to a WAV file, or to a headerless raw PCM
+ * file if the path ends in ".raw". Samples are collected in large chunks
+ * before being written, the WAV header sizes are filled in on close().
+ */
+class WavWriter {
+    std::ofstream m_file;
+    bool m_raw = false;
+    int m_sample_rate = 0;
+
+    std::vector<int16_t> m_chunk;
+    uint64_t m_sample_count = 0;
+
+    void write_header();
+    void flush();
+
+    public:
+        ~WavWriter();
+
+        bool open(const std::string& path, int sample_rate);
+        void write(const int16_t* samples, size_t sample_count);
+        void close();
+
+        bool is_open() const { return m_file.is_open(); }
+};
@@ -0,0 +1,267 @@
+#include <algorithm>
+#include <format>
+
+#include "analysis.h"
+#include "cpu.h"
+#include "disassembler.h"
+
+
+/**
+ * @brief How an instruction affects the flow of control.
+ */
+struct InstructionFlow {
+    bool ends_block = false;
+    uint16_t successors[2];
+    int successor_count = 0;
+
+    bool is_call = false;
+    uint16_t call_target = 0;
+    bool is_return = false;
+    bool is_indirect = false;
+};
+
+static uint16_t read_word(const Memory& memory, uint16_t address) {
+    return (memory[address] << 8) | memory[address + 1];
+}
+
+/**
+ * @brief Get the control flow of the instruction at an address.
+ */
+static InstructionFlow instruction_flow(const Memory& memory, uint16_t address) {
+    Instruction instr = decode(read_word(memory, address));
+    InstructionFlow flow;
+
+    uint16_t next = (address + 2) & ADDRESS_MASK;
+
+    switch (instr.op_id)
+    {
+    case OP_JUMP_ADDR:
+        flow.ends_block = true;
+        flow.successors[flow.successor_count++] = instr.nnn() & ADDRESS_MASK;
+        break;
+    case OP_CALL_SUBR:
+        flow.ends_block = true;
+        flow.is_call = true;
+        flow.call_target = instr.nnn() & ADDRESS_MASK;
+        flow.successors[flow.successor_count++] = next;
+        break;
+    case OP_RETURN:
+        flow.ends_block = true;
+        flow.is_return = true;
+        break;
+    case OP_SKIP_VAL_EQ:
+    case OP_SKIP_VAL_NEQ:
+    case OP_SKIP_REG_EQ:
+    case OP_SKIP_REQ_NEQ:
+    case OP_SKIP_KP:
+    case OP_SKIP_NOT_KP:
+        flow.ends_block = true;
+        flow.successors[flow.successor_count++] = next;
+        flow.successors[flow.successor_count++] = (address + 4) & ADDRESS_MASK;
+        break;
+    case OP_JUMP_OFFSET:
+        flow.ends_block = true;
+        flow.is_indirect = true;
+        break;
+    case OP_UNDEFINED:
+        // Most likely data that is never executed, don't follow it.
+        flow.ends_block = true;
+        break;
+    default:
+        flow.successors[flow.successor_count++] = next;
+        break;
+    }
+
+    return flow;
+}
+
+/**
+ * @brief Find the code of a program by following every path from its entry
+ * point, and build its control flow graph and call graph. Self-modifying code
+ * and the targets of BNNN jumps can not be followed statically.
+ *
+ * @param memory Memory with the program loaded.
+ * @param rom_size Size of the loaded ROM, bounds the data ranges in reports.
+ * @param entry Address of the first instruction.
+ * @return RomAnalysis The analysis.
+ */
+RomAnalysis analyze_rom(const Memory& memory, size_t rom_size, uint16_t entry) {
+    RomAnalysis analysis;
+    analysis.entry = entry & ADDRESS_MASK;
+    analysis.rom_size = rom_size;
+    analysis.byte_kinds.assign(MEMORY_SIZE, BYTE_DATA);
+
+    // Find all reachable instructions and the addresses that start a block.
+    std::set<uint16_t> leaders = {analysis.entry};
+    std::set<uint16_t> subroutines;
+    std::vector<uint16_t> worklist = {analysis.entry};
+
+    while (!worklist.empty()) {
+        uint16_t address = worklist.back();
+        worklist.pop_back();
+
+        if (analysis.byte_kinds[address] == BYTE_CODE) {
+            continue;
+        }
+
+        analysis.byte_kinds[address] = BYTE_CODE;
+
+        uint16_t operand = (address + 1) & ADDRESS_MASK;
+        if (analysis.byte_kinds[operand] == BYTE_DATA) {
+            analysis.byte_kinds[operand] = BYTE_OPERAND;
+        }
+
+        InstructionFlow flow = instruction_flow(memory, address);
+
+        for (int i = 0; i < flow.successor_count; i++) {
+            worklist.push_back(flow.successors[i]);
+
+            if (flow.ends_block) {
+                leaders.insert(flow.successors[i]);
+            }
+        }
+
+        if (flow.is_call) {
+            worklist.push_back(flow.call_target);
+            leaders.insert(flow.call_target);
+            subroutines.insert(flow.call_target);
+        }
+
+        if (flow.is_indirect) {
+            analysis.indirect_jumps.push_back(address);
+        }
+    }
+
+    std::sort(analysis.indirect_jumps.begin(), analysis.indirect_jumps.end());
+
+    // Cut the code in blocks at the leaders and at every block ending
+    // instruction.
+    for (uint16_t leader : leaders) {
+        BasicBlock block;
+        block.start = leader;
+        block.end = leader;
+
+        uint16_t address = leader;
+
+        for (int i = 0; i < MEMORY_SIZE / 2; i++) {
+            InstructionFlow flow = instruction_flow(memory, address);
+            uint16_t next = (address + 2) & ADDRESS_MASK;
+
+            if (flow.ends_block || leaders.contains(next)) {
+                block.end = next;
+                block.successors.assign(flow.successors, flow.successors + flow.successor_count);
+                block.ends_with_call = flow.is_call;
+                block.call_target = flow.call_target;
+                block.ends_with_return = flow.is_return;
+                block.ends_with_indirect_jump = flow.is_indirect;
+                break;
+            }
+
+            address = next;
+        }
+
+        analysis.blocks[leader] = block;
+    }
+
+    // Call graph: the calls in all blocks a subroutine reaches without
+    // following calls.
+    subroutines.insert(analysis.entry);
+
+    for (uint16_t subroutine : subroutines) {
+        std::set<uint16_t>& callees = analysis.calls[subroutine];
+        std::set<uint16_t> seen = {subroutine};
+        std::vector<uint16_t> pending = {subroutine};
+
+        while (!pending.empty()) {
+            const BasicBlock& block = analysis.blocks.at(pending.back());
+            pending.pop_back();
+
+            if (block.ends_with_call) {
+                callees.insert(block.call_target);
+            }
+
+            for (uint16_t successor : block.successors) {
+                if (seen.insert(successor).second) {
+                    pending.push_back(successor);
+                }
+            }
+        }
+    }
+
+    return analysis;
+}
+
+/**
+ * @brief Write a readable report of an analysis: the code and data in the ROM,
+ * every basic block, the call graph and the indirect jumps.
+ *
+ * @param analysis The analysis to report.
+ * @param memory Memory with the program loaded, to disassemble from.
+ * @param out Where to write the report.
+ */
+void print_rom_analysis(const RomAnalysis& analysis, const Memory& memory, std::ostream& out) {
+    size_t rom_end = std::min<size_t>(analysis.entry + analysis.rom_size, MEMORY_SIZE);
+
+    size_t code_bytes = 0;
+    for (size_t address = analysis.entry; address < rom_end; address++) {
+        code_bytes += analysis.byte_kinds[address] != BYTE_DATA;
+    }
+
+    out << std::format("entry {:03X}, rom {:03X}-{:03X} ({} bytes)\n", analysis.entry, analysis.entry, rom_end, analysis.rom_size);
+    out << std::format("code {} bytes, data {} bytes\n", code_bytes, rom_end - analysis.entry - code_bytes);
+
+    out << std::format("\nblocks ({}):\n", analysis.blocks.size());
+    for (const auto& [start, block] : analysis.blocks) {
+        std::string line = std::format("  {:03X}-{:03X}  {:<14}", block.start, block.end,
+            disassemble(decode(read_word(memory, (block.end - 2) & ADDRESS_MASK))));
+
+        if (block.ends_with_return) {
+            line += " return";
+        } else if (block.ends_with_indirect_jump) {
+            line += " indirect";
+        } else {
+            line += " ->";
+            for (uint16_t successor : block.successors) {
+                line += std::format(" {:03X}", successor);
+            }
+        }
+
+        if (block.ends_with_call) {
+            line += std::format("  (call {:03X})", block.call_target);
+        }
+
+        out << line << "\n";
+    }
+
+    out << "\ncall graph:\n";
+    for (const auto& [subroutine, callees] : analysis.calls) {
+        std::string line = std::format("  {:03X}{}", subroutine, subroutine == analysis.entry ? " (entry)" : "");
+
+        line += callees.empty() ? " calls nothing" : " calls";
+        for (uint16_t callee : callees) {
+            line += std::format(" {:03X}", callee);
+        }
+
+        out << line << "\n";
+    }
+
+    out << "\ndata ranges:\n";
+    for (size_t address = analysis.entry; address < rom_end;) {
+        if (analysis.byte_kinds[address] != BYTE_DATA) {
+            address++;
+            continue;
+        }
+
+        size_t start = address;
+        while (address < rom_end && analysis.byte_kinds[address] == BYTE_DATA) {
+            address++;
+        }
+
+        out << std::format("  {:03X}-{:03X} ({} bytes)\n", start, address, address - start);
+    }
+
+    out << "\nindirect jumps:\n";
+    for (uint16_t address : analysis.indirect_jumps) {
+        out << std::format("  {:03X}  {}\n", address, disassemble(decode(read_word(memory, address))));
+    }
+}
@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+
+#include "audio.h"
+#include "config.h"
+
+
+/**
+ * @brief Precompute one period of the tone.
+ *
+ * @param tone_hz Frequency of the beep.
+ * @param amplitude Peak amplitude of the samples.
+ * @param fade_ms Duration of the fade in and out.
+ */
+BeepGenerator::BeepGenerator(double tone_hz, double amplitude, double fade_ms) {
+    for (int i = 0; i < WAVETABLE_SIZE; i++) {
+        m_wavetable[i] = (int16_t) std::lround(amplitude * std::sin(2.0 * std::numbers::pi * i / WAVETABLE_SIZE));
+    }
+
+    m_phase_step = (uint32_t) std::lround(tone_hz / AUDIO_SAMPLE_RATE * 4294967296.0);
+
+    int fade_samples = std::max(1, (int) (fade_ms * AUDIO_SAMPLE_RATE / 1000));
+    m_envelope_step = std::max(1, 65536 / fade_samples);
+}
+
+/**
+ * @brief Fill a buffer with the beep, or with silence if it is not playing.
+ *
+ * @param buffer The buffer to fill.
+ * @param sample_count The amount of samples in buffer.
+ * @param playing Whether the beep should be audible.
+ */
+void BeepGenerator::generate(int16_t* buffer, int sample_count, bool playing) {
+    const int shift = 32 - WAVETABLE_BITS;
+    int32_t target = playing ? 65536 : 0;
+
+    // Silent and faded out: nothing to compute, but keep the phase running so
+    // the next beep starts where the wave would have been.
+    if (!playing && m_envelope == 0) {
+        std::memset(buffer, 0, sample_count * sizeof(int16_t));
+        m_phase += m_phase_step * (uint32_t) sample_count;
+        return;
+    }
+
+    int i = 0;
+
+    // Fade towards the target gain.
+    int32_t step = playing ? m_envelope_step : -m_envelope_step;
+    for (; i < sample_count && m_envelope != target; i++) {
+        m_envelope = std::clamp(m_envelope + step, 0, 65536);
+
+        buffer[i] = (m_wavetable[m_phase >> shift] * m_envelope) >> 16;
+        m_phase += m_phase_step;
+    }
+
+    if (!playing) {
+        std::memset(buffer + i, 0, (sample_count - i) * sizeof(int16_t));
+        m_phase += m_phase_step * (uint32_t) (sample_count - i);
+        return;
+    }
+
+    // Full volume, a plain table lookup per sample.
+    for (; i < sample_count; i++) {
+        buffer[i] = m_wavetable[m_phase >> shift];
+        m_phase += m_phase_step;
+    }
+}
+
+/**
+ * @brief Render the samples belonging to one executed instruction.
+ *
+ * @param sound_on Whether the sound timer is running after the instruction.
+ */
+void SoundRenderer::add_instruction(bool sound_on) {
+    const uint64_t INSTR_PER_SECOND = (uint64_t) (TIMER_FREQ * INSTR_PER_FRAME);
+
+    m_instruction_count++;
+
+    // Derived from the instruction count, so rounding never accumulates and
+    // every frame gets exactly its 735 samples.
+    uint64_t target = m_instruction_count * AUDIO_SAMPLE_RATE / INSTR_PER_SECOND;
+    int sample_count = (int) (target - m_sample_count);
+
+    if (sample_count == 0) {
+        return;
+    }
+
+    size_t start = m_samples.size();
+    m_samples.resize(start + sample_count);
+    m_beep.generate(m_samples.data() + start, sample_count, sound_on);
+
+    m_sample_count = target;
+}
+
+/**
+ * @brief Render silence (fading out a playing beep) outside of emulated time,
+ * e.g. to keep an audio device fed while the emulator is paused. This does
+ * not advance the emulated sample clock.
+ *
+ * @param sample_count Amount of samples to add.
+ */
+void SoundRenderer::add_silence(int sample_count) {
+    size_t start = m_samples.size();
+    m_samples.resize(start + sample_count);
+    m_beep.generate(m_samples.data() + start, sample_count, false);
+}
+
+/**
+ * @brief Remove samples from the front of the rendered samples.
+ *
+ * @param sample_count Amount of samples that were used.
+ */
+void SoundRenderer::consume(size_t sample_count) {
+    m_samples.erase(m_samples.begin(), m_samples.begin() + std::min(sample_count, m_samples.size()));
+}
@@ -0,0 +1,952 @@
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <numeric>
+
+#include "batch.h"
+#include "cpu.h"
+#include "opcodes.h"
+#include "config.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHIP8_BATCH_AVX2 1
+#include <immintrin.h>
+#else
+#define CHIP8_BATCH_AVX2 0
+#endif
+
+
+#if CHIP8_BATCH_AVX2
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET static inline __m256i load_group(const uint8_t* lanes) {
+    return _mm256_loadu_si256((const __m256i*) lanes);
+}
+
+/**
+ * @brief Expand a bitmask of lanes to a vector with all bits set in the byte
+ * of every lane whose bit is set.
+ */
+AVX2_TARGET static inline __m256i lane_mask(uint32_t lanes) {
+    // Byte i of the mask goes to lanes 8i to 8i + 7, then every lane tests
+    // its own bit.
+    const __m256i spread = _mm256_setr_epi64x(0x0000000000000000, 0x0101010101010101,
+        0x0202020202020202, 0x0303030303030303);
+    const __m256i bits = _mm256_set1_epi64x(0x8040201008040201);
+
+    __m256i bytes = _mm256_shuffle_epi8(_mm256_set1_epi32(lanes), spread);
+
+    return _mm256_cmpeq_epi8(_mm256_and_si256(bytes, bits), bits);
+}
+
+/**
+ * @brief Store val in the active lanes, the other lanes keep their value.
+ */
+AVX2_TARGET static inline void store_group(uint8_t* lanes, __m256i val, __m256i active) {
+    _mm256_storeu_si256((__m256i*) lanes, _mm256_blendv_epi8(load_group(lanes), val, active));
+}
+
+/**
+ * @brief Widen the 8bit lane mask to 16bit masks for the first and the last
+ * 16 lanes.
+ */
+AVX2_TARGET static inline void widen_mask(__m256i active, __m256i& active_lo, __m256i& active_hi) {
+    active_lo = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(active));
+    active_hi = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(active, 1));
+}
+
+/**
+ * @brief Store the 16bit values lo (first 16 lanes) and hi (last 16 lanes)
+ * in the active lanes of the 32 lanes starting at lanes.
+ */
+AVX2_TARGET static inline void store_group16(uint16_t* lanes, __m256i lo, __m256i hi, __m256i active) {
+    __m256i active_lo, active_hi;
+    widen_mask(active, active_lo, active_hi);
+
+    __m256i old_lo = _mm256_loadu_si256((const __m256i*) lanes);
+    __m256i old_hi = _mm256_loadu_si256((const __m256i*) (lanes + 16));
+
+    _mm256_storeu_si256((__m256i*) lanes, _mm256_blendv_epi8(old_lo, lo, active_lo));
+    _mm256_storeu_si256((__m256i*) (lanes + 16), _mm256_blendv_epi8(old_hi, hi, active_hi));
+}
+
+/**
+ * @brief Execute one instruction for the active lanes of a group at once.
+ * Every active lane must be at the same PC and see the same instruction.
+ *
+ * @param group The group to execute on.
+ * @param instr The decoded instruction.
+ * @param lanes Bitmask of the lanes to execute, bit i is lane i of the group.
+ * @return bool False if the instruction has no vector version, nothing is
+ * changed in that case.
+ */
+AVX2_TARGET static bool execute_group_avx2(const BatchGroup& group, Instruction instr, uint32_t lanes) {
+    const __m256i ones = _mm256_set1_epi8(1);
+    const __m256i active = lane_mask(lanes);
+
+    uint8_t* vx_lanes = group.registers[instr.x()];
+    uint8_t* vf_lanes = group.registers[0xF];
+    __m256i vx = load_group(vx_lanes);
+    __m256i vy = load_group(group.registers[instr.y()]);
+
+    // Lanes that skip the next instruction (all bits set), none by default.
+    __m256i skip = _mm256_setzero_si256();
+
+    switch (instr.op_id) {
+    case OP_JUMP_ADDR: {
+        __m256i target = _mm256_set1_epi16(instr.nnn());
+
+        store_group16(group.program_counter, target, target, active);
+        return true;
+    }
+    case OP_JUMP_OFFSET: {
+        __m256i v0 = load_group(group.registers[0]);
+        __m256i target = _mm256_set1_epi16(instr.nnn());
+        __m256i target_lo = _mm256_add_epi16(target, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v0)));
+        __m256i target_hi = _mm256_add_epi16(target, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v0, 1)));
+
+        store_group16(group.program_counter, target_lo, target_hi, active);
+        return true;
+    }
+    case OP_SKIP_VAL_EQ:
+        skip = _mm256_cmpeq_epi8(vx, _mm256_set1_epi8(instr.nn()));
+        break;
+    case OP_SKIP_VAL_NEQ:
+        skip = _mm256_xor_si256(_mm256_cmpeq_epi8(vx, _mm256_set1_epi8(instr.nn())), _mm256_set1_epi8(-1));
+        break;
+    case OP_SKIP_REG_EQ:
+        skip = _mm256_cmpeq_epi8(vx, vy);
+        break;
+    case OP_SKIP_REQ_NEQ:
+        skip = _mm256_xor_si256(_mm256_cmpeq_epi8(vx, vy), _mm256_set1_epi8(-1));
+        break;
+    case OP_SET_X:
+        store_group(vx_lanes, _mm256_set1_epi8(instr.nn()), active);
+        break;
+    case OP_ADD_X:
+        store_group(vx_lanes, _mm256_add_epi8(vx, _mm256_set1_epi8(instr.nn())), active);
+        break;
+    case OP_SET_X_Y:
+        store_group(vx_lanes, vy, active);
+        break;
+    case OP_OR:
+        store_group(vx_lanes, _mm256_or_si256(vx, vy), active);
+        break;
+    case OP_AND:
+        store_group(vx_lanes, _mm256_and_si256(vx, vy), active);
+        break;
+    case OP_XOR:
+        store_group(vx_lanes, _mm256_xor_si256(vx, vy), active);
+        break;
+    case OP_ADD_Y_TO_X: {
+        // The saturated and wrapped sums only differ when the add overflowed.
+        __m256i sum = _mm256_add_epi8(vx, vy);
+        __m256i no_carry = _mm256_cmpeq_epi8(_mm256_adds_epu8(vx, vy), sum);
+
+        store_group(vx_lanes, sum, active);
+        store_group(vf_lanes, _mm256_andnot_si256(no_carry, ones), active);
+        break;
+    }
+    case OP_SUB_Y_X: {
+        __m256i no_borrow = _mm256_cmpeq_epi8(_mm256_max_epu8(vx, vy), vx);
+
+        store_group(vx_lanes, _mm256_sub_epi8(vx, vy), active);
+        store_group(vf_lanes, _mm256_and_si256(no_borrow, ones), active);
+        break;
+    }
+    case OP_SUB_X_Y: {
+        __m256i no_borrow = _mm256_cmpeq_epi8(_mm256_max_epu8(vx, vy), vy);
+
+        store_group(vx_lanes, _mm256_sub_epi8(vy, vx), active);
+        store_group(vf_lanes, _mm256_and_si256(no_borrow, ones), active);
+        break;
+    }
+    case OP_SHIFT_RIGHT: {
+        // There is no 8bit shift, shift 16bit words and mask off the bit
+        // that moved in from the neighbouring byte.
+        __m256i shifted = _mm256_and_si256(_mm256_srli_epi16(vy, 1), _mm256_set1_epi8(0x7F));
+
+        store_group(vx_lanes, shifted, active);
+        store_group(vf_lanes, _mm256_and_si256(vy, ones), active);
+        break;
+    }
+    case OP_SHIFT_LEFT: {
+        __m256i bit_out = _mm256_and_si256(_mm256_srli_epi16(vy, 7), ones);
+
+        store_group(vx_lanes, _mm256_add_epi8(vy, vy), active);
+        store_group(vf_lanes, bit_out, active);
+        break;
+    }
+    case OP_SET_INDEX: {
+        __m256i index = _mm256_set1_epi16(instr.nnn());
+
+        store_group16(group.index_register, index, index, active);
+        break;
+    }
+    case OP_SET_I_SPRITE: {
+        // The font starts at 0x50, 5 bytes per character.
+        __m256i digit = _mm256_and_si256(vx, _mm256_set1_epi8(0x0F));
+        __m256i five = _mm256_set1_epi16(5);
+        __m256i font = _mm256_set1_epi16(0x050);
+        __m256i index_lo = _mm256_add_epi16(font, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(digit)), five));
+        __m256i index_hi = _mm256_add_epi16(font, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(digit, 1)), five));
+
+        store_group16(group.index_register, index_lo, index_hi, active);
+        break;
+    }
+    case OP_SET_X_DELAY:
+        store_group(vx_lanes, load_group(group.delay_timer), active);
+        break;
+    case OP_SET_DELAY_X:
+        store_group(group.delay_timer, vx, active);
+        break;
+    case OP_SET_SOUND_X:
+        store_group(group.sound_timer, vx, active);
+        break;
+    case OP_ADD_X_I: {
+        // When X is F the scalar handler adds the freshly set flag.
+        if (instr.x() == 0xF) {
+            return false;
+        }
+
+        __m256i index_lo = _mm256_loadu_si256((__m256i*) group.index_register);
+        __m256i index_hi = _mm256_loadu_si256((__m256i*) (group.index_register + 16));
+        __m256i sum_lo = _mm256_add_epi16(index_lo, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(vx)));
+        __m256i sum_hi = _mm256_add_epi16(index_hi, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(vx, 1)));
+
+        // The flag is set if the sum passed 0xFFF, including sums that
+        // wrapped around 16 bits.
+        const __m256i limit = _mm256_set1_epi16(0xFFF);
+        __m256i over_lo = _mm256_or_si256(
+            _mm256_xor_si256(_mm256_cmpeq_epi16(_mm256_max_epu16(sum_lo, limit), limit), _mm256_set1_epi16(-1)),
+            _mm256_xor_si256(_mm256_cmpeq_epi16(_mm256_max_epu16(sum_lo, index_lo), sum_lo), _mm256_set1_epi16(-1)));
+        __m256i over_hi = _mm256_or_si256(
+            _mm256_xor_si256(_mm256_cmpeq_epi16(_mm256_max_epu16(sum_hi, limit), limit), _mm256_set1_epi16(-1)),
+            _mm256_xor_si256(_mm256_cmpeq_epi16(_mm256_max_epu16(sum_hi, index_hi), sum_hi), _mm256_set1_epi16(-1)));
+
+        // Narrow the 16bit masks back to 8bit lanes, packs interleaves the
+        // 128bit halves so they have to be put back in order.
+        __m256i over = _mm256_permute4x64_epi64(_mm256_packs_epi16(over_lo, over_hi), 0xD8);
+
+        store_group16(group.index_register, sum_lo, sum_hi, active);
+        store_group(vf_lanes, ones, _mm256_and_si256(over, active));
+        break;
+    }
+    default:
+        return false;
+    }
+
+    // Advance the PC of every active lane past the instruction, and past the
+    // next one for the lanes that skip.
+    const __m256i two = _mm256_set1_epi16(2);
+    __m256i active_lo, active_hi;
+    widen_mask(active, active_lo, active_hi);
+
+    __m256i skip_lo = _mm256_and_si256(_mm256_cvtepi8_epi16(_mm256_castsi256_si128(skip)), two);
+    __m256i skip_hi = _mm256_and_si256(_mm256_cvtepi8_epi16(_mm256_extracti128_si256(skip, 1)), two);
+    __m256i pc_lo = _mm256_loadu_si256((__m256i*) group.program_counter);
+    __m256i pc_hi = _mm256_loadu_si256((__m256i*) (group.program_counter + 16));
+
+    pc_lo = _mm256_add_epi16(pc_lo, _mm256_and_si256(_mm256_add_epi16(two, skip_lo), active_lo));
+    pc_hi = _mm256_add_epi16(pc_hi, _mm256_and_si256(_mm256_add_epi16(two, skip_hi), active_hi));
+
+    _mm256_storeu_si256((__m256i*) group.program_counter, pc_lo);
+    _mm256_storeu_si256((__m256i*) (group.program_counter + 16), pc_hi);
+
+    return true;
+}
+
+/**
+ * @brief Find the lanes of a group that are at a PC.
+ *
+ * @return uint32_t Bitmask of the lanes, bit i is lane i of the group.
+ */
+AVX2_TARGET static uint32_t lanes_at_pc_avx2(const uint16_t* program_counter, uint16_t pc) {
+    __m256i target = _mm256_set1_epi16(pc);
+    __m256i eq_lo = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*) program_counter), target);
+    __m256i eq_hi = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*) (program_counter + 16)), target);
+
+    // Narrow to one byte per lane, in order.
+    __m256i eq = _mm256_permute4x64_epi64(_mm256_packs_epi16(eq_lo, eq_hi), 0xD8);
+
+    return _mm256_movemask_epi8(eq);
+}
+
+#endif
+
+/**
+ * @brief Create lane_count instances of a ROM. Every lane gets its own random
+ * seed (seed + lane index).
+ *
+ * @param lane_count Amount of instances.
+ * @param rom The ROM image every lane starts with.
+ * @param rom_size Size of the ROM image.
+ * @param seed Random seed of the first lane.
+ */
+Chip8Batch::Chip8Batch(int lane_count, const uint8_t* rom, size_t rom_size, uint32_t seed) {
+    m_lane_count = lane_count;
+
+    // The lanes are stored in whole groups, the padding lanes are never
+    // executed.
+    m_padded_lane_count = (lane_count + BATCH_GROUP_SIZE - 1) / BATCH_GROUP_SIZE * BATCH_GROUP_SIZE;
+
+    m_lanes.resize(m_padded_lane_count);
+    for (int i = 0; i < 16; i++) {
+        m_registers[i].resize(m_padded_lane_count);
+    }
+    m_index_register.resize(m_padded_lane_count);
+    m_program_counter.resize(m_padded_lane_count);
+    m_delay_timer.resize(m_padded_lane_count);
+    m_sound_timer.resize(m_padded_lane_count);
+
+    // All lanes are forks of the first one, so they share the memory pages of
+    // the ROM until they write to them.
+    Chip8State initial;
+    cpu_reset(initial, seed);
+    cpu_load_rom(initial, rom, rom_size);
+
+    for (int lane = 0; lane < m_padded_lane_count; lane++) {
+        m_lanes[lane] = initial.fork();
+        m_lanes[lane].rng_state = seed + lane != 0 ? seed + lane : 1;
+
+        store_lane(lane);
+    }
+
+    m_position_of_lane.resize(m_padded_lane_count);
+    m_lane_at_position.resize(m_padded_lane_count);
+    std::iota(m_position_of_lane.begin(), m_position_of_lane.end(), 0);
+    std::iota(m_lane_at_position.begin(), m_lane_at_position.end(), 0);
+
+    for (int first_lane = 0; first_lane < m_padded_lane_count; first_lane += BATCH_GROUP_SIZE) {
+        BatchGroup group;
+
+        for (int i = 0; i < 16; i++) {
+            group.registers[i] = m_registers[i].data() + first_lane;
+        }
+
+        group.index_register = m_index_register.data() + first_lane;
+        group.program_counter = m_program_counter.data() + first_lane;
+        group.delay_timer = m_delay_timer.data() + first_lane;
+        group.sound_timer = m_sound_timer.data() + first_lane;
+
+        m_groups.push_back(group);
+    }
+
+#if CHIP8_BATCH_AVX2
+    m_use_avx2 = __builtin_cpu_supports("avx2");
+#else
+    m_use_avx2 = false;
+#endif
+}
+
+/**
+ * @brief Copy the hot state of a lane from its Chip8State back into the
+ * arrays.
+ */
+void Chip8Batch::store_lane(int lane) {
+    const Chip8State& state = m_lanes[lane];
+
+    for (int i = 0; i < 16; i++) {
+        m_registers[i][lane] = state.registers[i];
+    }
+
+    m_index_register[lane] = state.index_register;
+    m_program_counter[lane] = state.program_counter;
+    m_delay_timer[lane] = state.delay_timer;
+    m_sound_timer[lane] = state.sound_timer;
+}
+
+/**
+ * @brief Execute an instruction on some lanes of a group one by one,
+ * directly on the structure of arrays state. Behaves exactly like execute()
+ * after fetch() on every lane, flag register ordering included; the stack,
+ * memory, screen and keys are taken from the cold state of each lane.
+ *
+ * @param first_lane The first lane of the group.
+ * @param lanes Bitmask of the lanes to execute, bit i is lane i of the group.
+ * @param instr The decoded instruction at the PC of the lanes.
+ */
+void Chip8Batch::execute_lanes(int first_lane, uint32_t lanes, Instruction instr) {
+    uint8_t x = instr.x();
+    uint8_t y = instr.y();
+
+    uint8_t* vx = m_registers[x].data();
+    uint8_t* vy = m_registers[y].data();
+    uint8_t* vf = m_registers[0xF].data();
+    uint16_t* pc = m_program_counter.data();
+    uint16_t* index = m_index_register.data();
+
+    auto for_each_lane = [&](auto&& execute_lane) {
+        for (uint32_t rest = lanes; rest; rest &= rest - 1) {
+            execute_lane(first_lane + std::countr_zero(rest));
+        }
+    };
+
+    auto fault_lane = [&](int lane) {
+        m_groups[first_lane / BATCH_GROUP_SIZE].faulted_lanes |= 1u << (lane - first_lane);
+    };
+
+    for_each_lane([&](int lane) { pc[lane] += 2; });
+
+    switch (instr.op_id) {
+    case OP_CLEAR_SCREEN:
+        for_each_lane([&](int lane) {
+            std::fill(m_lanes[lane].pixel_buffer, m_lanes[lane].pixel_buffer + 32, 0);
+        });
+        break;
+    case OP_JUMP_ADDR:
+        for_each_lane([&](int lane) { pc[lane] = instr.nnn(); });
+        break;
+    case OP_RETURN:
+        for_each_lane([&](int lane) {
+            if (!pop_stack(m_lanes[lane], pc[lane])) {
+                fault_lane(lane);
+            }
+        });
+        break;
+    case OP_CALL_SUBR:
+        for_each_lane([&](int lane) {
+            if (push_stack(m_lanes[lane], pc[lane])) {
+                pc[lane] = instr.nnn();
+            } else {
+                fault_lane(lane);
+            }
+        });
+        break;
+    case OP_SKIP_VAL_EQ:
+        for_each_lane([&](int lane) { pc[lane] += vx[lane] == instr.nn() ? 2 : 0; });
+        break;
+    case OP_SKIP_VAL_NEQ:
+        for_each_lane([&](int lane) { pc[lane] += vx[lane] != instr.nn() ? 2 : 0; });
+        break;
+    case OP_SKIP_REG_EQ:
+        for_each_lane([&](int lane) { pc[lane] += vx[lane] == vy[lane] ? 2 : 0; });
+        break;
+    case OP_SKIP_REQ_NEQ:
+        for_each_lane([&](int lane) { pc[lane] += vx[lane] != vy[lane] ? 2 : 0; });
+        break;
+    case OP_SET_X:
+        for_each_lane([&](int lane) { vx[lane] = instr.nn(); });
+        break;
+    case OP_ADD_X:
+        for_each_lane([&](int lane) { vx[lane] += instr.nn(); });
+        break;
+    case OP_ADD_X_TO_Y:
+        for_each_lane([&](int lane) { vy[lane] += vx[lane]; });
+        break;
+    case OP_SET_X_Y:
+        for_each_lane([&](int lane) { vx[lane] = vy[lane]; });
+        break;
+    case OP_OR:
+        for_each_lane([&](int lane) { vx[lane] |= vy[lane]; });
+        break;
+    case OP_AND:
+        for_each_lane([&](int lane) { vx[lane] &= vy[lane]; });
+        break;
+    case OP_XOR:
+        for_each_lane([&](int lane) { vx[lane] ^= vy[lane]; });
+        break;
+    case OP_ADD_Y_TO_X:
+        for_each_lane([&](int lane) {
+            bool overflowed = vx[lane] + vy[lane] > 0xFF;
+            vx[lane] += vy[lane];
+            vf[lane] = overflowed;
+        });
+        break;
+    case OP_SUB_Y_X:
+        for_each_lane([&](int lane) {
+            uint8_t flag = vy[lane] <= vx[lane];
+            vx[lane] = vx[lane] - vy[lane];
+            vf[lane] = flag;
+        });
+        break;
+    case OP_SUB_X_Y:
+        for_each_lane([&](int lane) {
+            uint8_t flag = vx[lane] <= vy[lane];
+            vx[lane] = vy[lane] - vx[lane];
+            vf[lane] = flag;
+        });
+        break;
+    case OP_SHIFT_RIGHT:
+        for_each_lane([&](int lane) {
+            bool bit_out = vy[lane] & 0b1;
+            vx[lane] = vy[lane] >> 1;
+            vf[lane] = bit_out;
+        });
+        break;
+    case OP_SHIFT_LEFT:
+        for_each_lane([&](int lane) {
+            bool bit_out = vy[lane] & 0b10000000;
+            vx[lane] = vy[lane] << 1;
+            vf[lane] = bit_out;
+        });
+        break;
+    case OP_SET_INDEX:
+        for_each_lane([&](int lane) { index[lane] = instr.nnn(); });
+        break;
+    case OP_JUMP_OFFSET:
+        for_each_lane([&](int lane) { pc[lane] = instr.nnn() + m_registers[0][lane]; });
+        break;
+    case OP_SET_X_RAND:
+        for_each_lane([&](int lane) { vx[lane] = (cpu_random(m_lanes[lane]) % 255) & instr.nn(); });
+        break;
+    case OP_DRAW:
+        for_each_lane([&](int lane) {
+            vf[lane] = draw_sprite(m_lanes[lane], vx[lane], vy[lane], index[lane], instr.n());
+        });
+        break;
+    case OP_SKIP_KP:
+        for_each_lane([&](int lane) { pc[lane] += m_lanes[lane].keys_pressed[vx[lane] & 0xF] ? 2 : 0; });
+        break;
+    case OP_SKIP_NOT_KP:
+        for_each_lane([&](int lane) { pc[lane] += !m_lanes[lane].keys_pressed[vx[lane] & 0xF] ? 2 : 0; });
+        break;
+    case OP_SET_X_DELAY:
+        for_each_lane([&](int lane) { vx[lane] = m_delay_timer[lane]; });
+        break;
+    case OP_WAIT_KP:
+        for_each_lane([&](int lane) {
+            // The lowest released key wins, without one the instruction
+            // repeats.
+            const bool* released = m_lanes[lane].keys_released;
+            int key = std::find(released, released + 16, true) - released;
+
+            if (key == 16) {
+                pc[lane] -= 2;
+            } else {
+                vx[lane] = key;
+            }
+        });
+        break;
+    case OP_SET_DELAY_X:
+        for_each_lane([&](int lane) { m_delay_timer[lane] = vx[lane]; });
+        break;
+    case OP_SET_SOUND_X:
+        for_each_lane([&](int lane) { m_sound_timer[lane] = vx[lane]; });
+        break;
+    case OP_ADD_X_I:
+        for_each_lane([&](int lane) {
+            if (index[lane] + vx[lane] > 0xFFF) {
+                vf[lane] = 1;
+            }
+
+            index[lane] += vx[lane];
+        });
+        break;
+    case OP_SET_I_SPRITE:
+        for_each_lane([&](int lane) { index[lane] = 0x050 + (vx[lane] & 0x0F) * 5; });
+        break;
+    case OP_WRITE_BCD:
+        for_each_lane([&](int lane) {
+            Memory& memory = m_lanes[lane].memory;
+
+            for (int i = 0; i < 3; i++) {
+                m_written[(index[lane] + i) & ADDRESS_MASK] = true;
+            }
+
+            memory.write(index[lane], vx[lane] / 100);
+            memory.write(index[lane] + 1, vx[lane] / 10 % 10);
+            memory.write(index[lane] + 2, vx[lane] % 10);
+        });
+        break;
+    case OP_WRITE_REGS:
+        for_each_lane([&](int lane) {
+            for (int i = 0; i <= x; i++) {
+                m_written[index[lane] & ADDRESS_MASK] = true;
+                m_lanes[lane].memory.write(index[lane]++, m_registers[i][lane]);
+            }
+        });
+        break;
+    case OP_READ_REGS:
+        for_each_lane([&](int lane) {
+            for (int i = 0; i <= x; i++) {
+                m_registers[i][lane] = m_lanes[lane].memory[index[lane]++];
+            }
+        });
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Try to execute the instruction for some lanes of a group with AVX2.
+ *
+ * @param lanes Bitmask of the lanes to execute, bit i is lane i of the group.
+ * @return bool False if the lanes have to fall back to the scalar path.
+ */
+bool Chip8Batch::step_group_vector(int first_lane, Instruction instr, uint32_t lanes) {
+#if CHIP8_BATCH_AVX2
+    return execute_group_avx2(m_groups[first_lane / BATCH_GROUP_SIZE], instr, lanes);
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Find the lanes of a group that are at a PC.
+ *
+ * @return uint32_t Bitmask of the lanes, bit i is lane i of the group.
+ */
+uint32_t Chip8Batch::lanes_at_pc(int first_lane, uint16_t pc) const {
+    const uint16_t* program_counter = m_program_counter.data() + first_lane;
+
+#if CHIP8_BATCH_AVX2
+    if (m_use_avx2) {
+        return lanes_at_pc_avx2(program_counter, pc);
+    }
+#endif
+
+    uint32_t lanes = 0;
+    for (int i = 0; i < BATCH_GROUP_SIZE; i++) {
+        lanes |= (uint32_t) (program_counter[i] == pc) << i;
+    }
+
+    return lanes;
+}
+
+/**
+ * @brief Execute one instruction on every lane of a group. The lanes are
+ * taken per PC, starting with the first lane: the lanes at that PC that see
+ * the same instruction there run together with AVX2 under a mask, a handful
+ * of lanes or an instruction without vector version on the scalar path.
+ * Either way the instruction is decoded once for all of them.
+ *
+ * @param first_lane The first lane of the group.
+ * @return int Amount of different instructions the lanes were at.
+ */
+int Chip8Batch::step_group(int first_lane) {
+    static_assert(BATCH_GROUP_SIZE == 32, "A group is tracked in a 32bit mask");
+
+    int group_lane_count = std::min(BATCH_GROUP_SIZE, m_lane_count - first_lane);
+    uint32_t pending = group_lane_count == 32 ? UINT32_MAX : (1u << group_lane_count) - 1;
+    pending &= ~m_groups[first_lane / BATCH_GROUP_SIZE].faulted_lanes;
+    int instr_count = 0;
+
+    while (pending) {
+        instr_count++;
+
+        int leader = std::countr_zero(pending);
+        uint16_t pc = m_program_counter[first_lane + leader];
+        Instruction instr = m_cache.lookup(m_lanes[first_lane + leader].memory, pc).instr[0];
+
+        // Every lane has its own memory, so a lane may have modified the
+        // code. Only the lanes that see the same opcode run together, which
+        // needs no checking where no lane ever wrote.
+        uint32_t lanes = lanes_at_pc(first_lane, pc) & pending;
+        bool maybe_modified = m_written[pc & ADDRESS_MASK] || m_written[(pc + 1) & ADDRESS_MASK];
+
+        for (uint32_t others = maybe_modified ? lanes & (lanes - 1) : 0; others; others &= others - 1) {
+            int i = std::countr_zero(others);
+            const Memory& memory = m_lanes[first_lane + i].memory;
+
+            if (((memory[pc] << 8) | memory[pc + 1]) != instr.raw) {
+                lanes &= ~(1u << i);
+            }
+        }
+
+        pending &= ~lanes;
+
+        int lane_count = std::popcount(lanes);
+
+        if (m_use_avx2 && lane_count >= MIN_VECTOR_LANES && step_group_vector(first_lane, instr, lanes)) {
+            m_vector_steps += lane_count;
+            continue;
+        }
+
+        execute_lanes(first_lane, lanes, instr);
+        m_scalar_steps += lane_count;
+    }
+
+    return instr_count;
+}
+
+/**
+ * @brief Execute the rest of a frame on a single lane, for lanes that no
+ * longer run in lockstep with the rest of their group.
+ *
+ * @param lane The lane to execute on.
+ * @param first_step The step of the frame to start at.
+ * @param decrement_counts The timer decrements after every step of the frame.
+ */
+void Chip8Batch::run_lane(int lane, int first_step, const int* decrement_counts) {
+    int first_lane = lane - lane % BATCH_GROUP_SIZE;
+    uint32_t lane_bit = 1u << (lane % BATCH_GROUP_SIZE);
+
+    const uint32_t& faulted_lanes = m_groups[first_lane / BATCH_GROUP_SIZE].faulted_lanes;
+    uint16_t& pc = m_program_counter[lane];
+    int i = first_step;
+
+    while (i < INSTR_PER_FRAME) {
+        // A faulted lane only lets the time pass.
+        if (faulted_lanes & lane_bit) {
+            update_clocks(lane, 1, decrement_counts[i]);
+            i++;
+            continue;
+        }
+
+        uint16_t start = pc;
+        const PredecodedEntry& entry = m_cache.lookup(m_lanes[lane].memory, start);
+
+        // The instructions of a superinstruction don't write memory, so they
+        // stay valid while the lane falls through them.
+        int length = entry.length <= INSTR_PER_FRAME - i ? entry.length : 1;
+
+        for (int k = 0; k < length && pc == (uint16_t) (start + k * 2); k++) {
+            execute_lanes(first_lane, lane_bit, entry.instr[k]);
+            update_clocks(lane, 1, decrement_counts[i]);
+            i++;
+        }
+    }
+
+    m_scalar_steps += INSTR_PER_FRAME - first_step;
+}
+
+/**
+ * @brief Decrement the delay and sound timers of a range of lanes, the same
+ * way the scalar core does after each instruction.
+ *
+ * @param first_lane The first lane to update.
+ * @param count Amount of lanes to update.
+ * @param decrement_count Amount to decrement by, see advance_timer_accum().
+ */
+void Chip8Batch::update_clocks(int first_lane, int count, int decrement_count) {
+    if (decrement_count == 0) {
+        return;
+    }
+
+    // Written as a plain loop, the compiler vectorizes the saturating
+    // subtract on its own.
+    for (int lane = first_lane; lane < first_lane + count; lane++) {
+        m_delay_timer[lane] = m_delay_timer[lane] < decrement_count ? 0 : m_delay_timer[lane] - decrement_count;
+        m_sound_timer[lane] = m_sound_timer[lane] < decrement_count ? 0 : m_sound_timer[lane] - decrement_count;
+    }
+}
+
+/**
+ * @brief Execute one instruction on every lane.
+ */
+void Chip8Batch::step() {
+    for (int first_lane = 0; first_lane < m_padded_lane_count; first_lane += BATCH_GROUP_SIZE) {
+        step_group(first_lane);
+    }
+
+    update_clocks(0, m_padded_lane_count, advance_timer_accum(m_timer_accum, 1000.f / (TIMER_FREQ * INSTR_PER_FRAME)));
+}
+
+/**
+ * @brief Execute one frame worth of instructions on every lane, see
+ * cpu_execute_frame().
+ */
+void Chip8Batch::run_frame() {
+    // The lanes only share the timer accumulator, so the timer decrements of
+    // the frame are known up front. A group can run the whole frame before
+    // the next one starts, while its cold state is still in the cache, and
+    // its lanes can leave the lockstep.
+    int decrement_counts[INSTR_PER_FRAME];
+    for (int i = 0; i < INSTR_PER_FRAME; i++) {
+        decrement_counts[i] = advance_timer_accum(m_timer_accum, 1000.f / (TIMER_FREQ * INSTR_PER_FRAME));
+    }
+
+    if (m_regroup) {
+        regroup();
+    }
+
+    for (int first_lane = 0; first_lane < m_padded_lane_count; first_lane += BATCH_GROUP_SIZE) {
+        for (int i = 0; i < INSTR_PER_FRAME; i++) {
+            int instr_count = step_group(first_lane);
+            update_clocks(first_lane, BATCH_GROUP_SIZE, decrement_counts[i]);
+
+            // Spread over this many instructions, the lanes are faster one
+            // by one. They get another chance at the next frame.
+            if (instr_count > MAX_LOCKSTEP_INSTRUCTIONS) {
+                for (int lane = first_lane; lane < std::min(first_lane + BATCH_GROUP_SIZE, m_lane_count); lane++) {
+                    run_lane(lane, i + 1, decrement_counts);
+                }
+
+                m_regroup = true;
+                break;
+            }
+        }
+    }
+
+    for (Chip8State& lane : m_lanes) {
+        for (int i = 0; i < 16; i++) {
+            lane.keys_released[i] = false;
+        }
+    }
+}
+
+/**
+ * @brief Reorder the lanes by PC, so lanes that drifted apart in other
+ * groups, e.g. because a key made them take a branch, are executed together
+ * again. Only the positions change, the lane numbers stay the same.
+ */
+void Chip8Batch::regroup() {
+    std::vector<int> order(m_padded_lane_count);
+    std::iota(order.begin(), order.end(), 0);
+
+    // The padding lanes stay at the end.
+    std::stable_sort(order.begin(), order.begin() + m_lane_count, [&](int a, int b) {
+        return m_program_counter[a] < m_program_counter[b];
+    });
+
+    // In place, the groups point into the arrays.
+    auto reorder = [&](auto& array) {
+        auto old = array;
+
+        for (int position = 0; position < m_padded_lane_count; position++) {
+            array[position] = old[order[position]];
+        }
+    };
+
+    for (int i = 0; i < 16; i++) {
+        reorder(m_registers[i]);
+    }
+
+    reorder(m_index_register);
+    reorder(m_program_counter);
+    reorder(m_delay_timer);
+    reorder(m_sound_timer);
+    reorder(m_lane_at_position);
+
+    std::vector<Chip8State> lanes;
+    lanes.reserve(m_padded_lane_count);
+
+    for (int position = 0; position < m_padded_lane_count; position++) {
+        lanes.push_back(std::move(m_lanes[order[position]]));
+    }
+
+    m_lanes.swap(lanes);
+
+    for (int position = 0; position < m_padded_lane_count; position++) {
+        m_position_of_lane[m_lane_at_position[position]] = position;
+    }
+
+    for (int first_lane = 0; first_lane < m_padded_lane_count; first_lane += BATCH_GROUP_SIZE) {
+        BatchGroup& group = m_groups[first_lane / BATCH_GROUP_SIZE];
+        group.faulted_lanes = 0;
+
+        for (int i = 0; i < BATCH_GROUP_SIZE; i++) {
+            group.faulted_lanes |= (uint32_t) (m_lanes[first_lane + i].fault != FAULT_NONE) << i;
+        }
+    }
+
+    m_regroup = false;
+}
+
+/**
+ * @brief Hold down the keys in key_mask (bit N is key N) on a lane, keys that
+ * go up are marked as released.
+ */
+void Chip8Batch::set_keys(int lane, uint16_t key_mask) {
+    cpu_set_keys(m_lanes[m_position_of_lane[lane]], key_mask);
+}
+
+/**
+ * @brief Get the complete state of a single lane.
+ */
+Chip8State Chip8Batch::get_lane(int lane) const {
+    lane = m_position_of_lane[lane];
+    Chip8State state = m_lanes[lane];
+
+    for (int i = 0; i < 16; i++) {
+        state.registers[i] = m_registers[i][lane];
+    }
+
+    state.index_register = m_index_register[lane];
+    state.program_counter = m_program_counter[lane];
+    state.delay_timer = m_delay_timer[lane];
+    state.sound_timer = m_sound_timer[lane];
+    state.timer_accum = m_timer_accum;
+
+    return state;
+}
+
+/**
+ * @brief Run the same ROM on many instances with the scalar core and with
+ * the batch engine, report the throughput of both and check they agree.
+ *
+ * @param rom_path Path of the ROM to run.
+ * @param lane_count Amount of instances.
+ * @param frame_count Amount of frames to run every instance for.
+ * @return int Exit code, non-zero if the two engines disagree.
+ */
+int run_batch_benchmark(const char* rom_path, int lane_count, int frame_count) {
+    std::ifstream file(rom_path, std::ios_base::binary);
+
+    if (!file) {
+        std::cerr << "Could not read ROM." << std::endl;
+        return 1;
+    }
+
+    std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    // Give every lane a different input, so they actually diverge.
+    auto key_mask = [](int lane, int frame) -> uint16_t {
+        return ((frame / 8 + lane) % 17) < 16 ? 1 << ((frame / 8 + lane) % 17) : 0;
+    };
+
+    // Scalar reference
+    std::vector<Chip8State> states(lane_count);
+    for (int lane = 0; lane < lane_count; lane++) {
+        cpu_reset(states[lane], 1 + lane);
+        cpu_load_rom(states[lane], rom.data(), rom.size());
+    }
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    for (int frame = 0; frame < frame_count; frame++) {
+        for (int lane = 0; lane < lane_count; lane++) {
+            Chip8State& state = states[lane];
+
+            cpu_set_keys(state, key_mask(lane, frame));
+            cpu_execute_frame(state);
+        }
+    }
+
+    double scalar_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    // Batch engine
+    std::unique_ptr<Chip8Batch> batch = std::make_unique<Chip8Batch>(lane_count, rom.data(), rom.size(), 1);
+
+    start_time = std::chrono::steady_clock::now();
+
+    for (int frame = 0; frame < frame_count; frame++) {
+        for (int lane = 0; lane < lane_count; lane++) {
+            batch->set_keys(lane, key_mask(lane, frame));
+        }
+
+        batch->run_frame();
+    }
+
+    double batch_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    int mismatches = 0;
+    for (int lane = 0; lane < lane_count; lane++) {
+        Chip8State state = batch->get_lane(lane);
+
+        if (cpu_framebuffer_hash(state) != cpu_framebuffer_hash(states[lane]) ||
+            state.program_counter != states[lane].program_counter ||
+            !std::equal(state.registers, state.registers + 16, states[lane].registers)) {
+            mismatches++;
+        }
+    }
+
+    double steps = (double) lane_count * frame_count * INSTR_PER_FRAME;
+    uint64_t lane_steps = batch->vector_steps() + batch->scalar_steps();
+
+    std::cout << std::format("lanes {}, frames {}, avx2 {}", lane_count, frame_count, batch->using_avx2() ? "yes" : "no") << std::endl;
+    std::cout << std::format("scalar core: {:.1f} M instances*steps/s", steps / scalar_s / 1e6) << std::endl;
+    std::cout << std::format("batch:       {:.1f} M instances*steps/s ({:.2f}x)", steps / batch_s / 1e6, scalar_s / batch_s) << std::endl;
+    std::cout << std::format("instance steps executed with AVX2 {:.1f}%", lane_steps ? 100.0 * batch->vector_steps() / lane_steps : 0.0) << std::endl;
+    std::cout << std::format("lanes differing from the scalar core: {}", mismatches) << std::endl;
+
+    return mismatches == 0 ? 0 : 1;
+}
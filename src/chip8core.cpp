@@ -0,0 +1,77 @@
+#include "chip8core.h"
+
+
+/**
+ * @brief Create a machine in its power-on state, without a ROM.
+ *
+ * @param seed Seed for the random number generator used by CXNN.
+ * @param quirks Behaviour of the machine, kept over resets.
+ */
+Chip8::Chip8(uint32_t seed, Quirks quirks) : m_state(std::make_unique<Chip8State>()) {
+    m_state->quirks = quirks;
+    cpu_reset(*m_state, seed);
+}
+
+/**
+ * @brief Put the machine back in its power-on state, the ROM has to be
+ * loaded again.
+ */
+void Chip8::reset(uint32_t seed) {
+    cpu_reset(*m_state, seed);
+}
+
+/**
+ * @brief Copy a ROM image into memory at 0x200, where execution starts.
+ *
+ * @param data The raw ROM bytes.
+ * @param size Amount of bytes in data.
+ * @return bool False if the ROM does not fit in memory.
+ */
+bool Chip8::load_rom(const uint8_t* data, size_t size) {
+    return cpu_load_rom(*m_state, data, size);
+}
+
+/**
+ * @brief Execute single instructions. Unlike run_frames() the key releases
+ * stay set, they are only cleared at the end of a frame.
+ *
+ * @param count Amount of instructions to execute.
+ */
+void Chip8::step(uint64_t count) {
+    for (uint64_t i = 0; i < count; i++) {
+        cpu_execute_instruction(*m_state);
+    }
+}
+
+/**
+ * @brief Execute whole frames (1/60th of a second each).
+ *
+ * @param count Amount of frames to execute.
+ * @param sound Optional, receives the audio of the frames.
+ */
+void Chip8::run_frames(uint64_t count, SoundRenderer* sound) {
+    for (uint64_t i = 0; i < count; i++) {
+        cpu_execute_frame(*m_state, sound);
+    }
+}
+
+/**
+ * @brief Press or release a single key (0x0 - 0xF).
+ */
+void Chip8::set_key(int key, bool pressed) {
+    key &= 0xF;
+
+    if (m_state->keys_pressed[key] && !pressed) {
+        m_state->keys_released[key] = true;
+    }
+
+    m_state->keys_pressed[key] = pressed;
+}
+
+/**
+ * @brief Hold down the keys in key_mask (bit N is key N), keys that go up are
+ * marked as released.
+ */
+void Chip8::set_keys(uint16_t key_mask) {
+    cpu_set_keys(*m_state, key_mask);
+}
@@ -2,47 +2,26 @@
 #include <format>
 #include <stdint.h>
 #include <cmath>
-#include <SDL.h>
+#include <bit>
 
 #include "cpu.h"
 #include "opcodes.h"
 #include "memory.h"
 #include "logger.h"
 #include "config.h"
+#include "audio.h"
+#include "predecode.h"
 
 // Configurables
 const float TIMER_DEC_RATE = 60.f;  // Hz
 
-// Inputs
-bool keys_pressed[16] = {false};
-bool keys_released[16] = {false};
-
-// Graphics
-bool pixel_buffer[32][64] = { false };
-
-// Memory
-uint8_t memory[4096] = { 0x0 };
-
-// Registers
-uint16_t index_register = 0x0;
-uint8_t registers[16] = { 0x0 };
-uint16_t program_counter = 0x200;
-
-// Timers
-uint8_t delay_timer = 0x0;
-uint8_t sound_timer = 0x0;
-
-float timer_accum = 0;
-
-// Stack
-uint8_t stack_pointer = 0x0;
-uint16_t stack[16] = {0x0};
 
 /**
  * @brief Load font data into the CHIP8 memory.
  *
+ * @param state The machine to load the fonts into.
  */
-void load_fonts() {
+void load_fonts(Chip8State& state) {
     const uint8_t FONT_DATA[] = {
                 0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
                 0x20, 0x60, 0x20, 0x20, 0x70, // 1
@@ -62,49 +41,150 @@ void load_fonts() {
                 0xF0, 0x80, 0xF0, 0x80, 0x80  // F}
     };
 
-    std::copy(FONT_DATA, FONT_DATA + (5 * 16), memory + 0x050);
+    state.memory.write_block(0x050, FONT_DATA, 5 * 16);
+}
+
+/**
+ * @brief Put a machine in its power-on state: everything cleared, the PC at
+ * the start of the program area and the fonts loaded. The quirk settings are
+ * kept.
+ *
+ * @param state The machine to reset.
+ * @param seed Seed for the random number generator used by CXNN.
+ */
+void cpu_reset(Chip8State& state, uint32_t seed) {
+    Quirks quirks = state.quirks;
+
+    state = Chip8State();
+    state.quirks = quirks;
+
+    state.program_counter = 0x200;
+
+    // Xorshift gets stuck on a zero state.
+    state.rng_state = seed != 0 ? seed : 1;
+
+    load_fonts(state);
+}
+
+/**
+ * @brief Copy a ROM image into the machine memory starting at offset.
+ *
+ * @param state The machine to load the ROM into.
+ * @param data The raw ROM bytes.
+ * @param size Amount of bytes in data.
+ * @param offset Starting address of the ROM in memory.
+ * @return bool False if the ROM does not fit in memory.
+ */
+bool cpu_load_rom(Chip8State& state, const uint8_t* data, size_t size, uint16_t offset) {
+    if (offset >= MEMORY_SIZE || size > (size_t) (MEMORY_SIZE - offset)) {
+        return false;
+    }
+
+    state.memory.write_block(offset, data, size);
+
+    return true;
+}
+
+/**
+ * @brief Hold down the keys in key_mask (bit N is key N), keys that go up are
+ * marked as released just like the GUI does.
+ *
+ * @param state The machine to set the keys of.
+ * @param key_mask The keys that are down.
+ */
+void cpu_set_keys(Chip8State& state, uint16_t key_mask) {
+    for (int key = 0; key < 16; key++) {
+        bool pressed = (key_mask >> key) & 0b1;
+
+        if (state.keys_pressed[key] && !pressed) {
+            state.keys_released[key] = true;
+        }
+
+        state.keys_pressed[key] = pressed;
+    }
 }
 
 
+/**
+ * @brief Create an independent copy of the machine. This is cheap: the memory
+ * pages are shared until either machine writes to them, so the cost of a fork
+ * is proportional to the pages touched afterwards.
+ *
+ * @return Chip8State The forked machine.
+ */
+Chip8State Chip8State::fork() const {
+    return *this;
+}
+
 /**
  * @brief Push a 16bit value onto the stack, increment the stack pointer.
  *
+ * @param state The machine to operate on.
  * @param val The value to push onto the stack.
+ * @return bool False if the stack is full, the machine faulted.
  */
-void push_stack(uint16_t val) {
-    if (stack_pointer > 15) {
-        throw std::runtime_error("Stack cannot be pushed if it is full (sp=15+)");
+bool push_stack(Chip8State& state, uint16_t val) {
+    if (state.stack_pointer > 15) {
+        state.fault = FAULT_STACK_OVERFLOW;
+        return false;
     }
 
-    stack[stack_pointer] = val;
+    state.stack[state.stack_pointer] = val;
+
+    state.stack_pointer++;
 
-    stack_pointer++;
+    return true;
 }
 
 /**
  * @brief Pop a 16bit value from the stack. Decrement the stack pointer.
  *
- * @return uint16_t The popped value.
+ * @param state The machine to operate on.
+ * @param val Receives the popped value, untouched if the stack is empty.
+ * @return bool False if the stack is empty, the machine faulted.
  */
-uint16_t pop_stack() {
-    if (stack_pointer == 0) {
-        throw std::runtime_error("Stack cannot be popped if the stack pointer is zero.");
+bool pop_stack(Chip8State& state, uint16_t& val) {
+    if (state.stack_pointer == 0) {
+        state.fault = FAULT_STACK_UNDERFLOW;
+        return false;
     }
 
-    stack_pointer--;
+    state.stack_pointer--;
 
-    return stack[stack_pointer];
+    val = state.stack[state.stack_pointer];
+
+    return true;
+}
+
+/**
+ * @brief Generate the next pseudo-random byte (xorshift32). Replaces rand(),
+ * which is neither seedable per instance nor thread-safe.
+ *
+ * @param state The machine whose generator to advance.
+ * @return uint8_t A pseudo-random byte.
+ */
+uint8_t cpu_random(Chip8State& state) {
+    uint32_t x = state.rng_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    state.rng_state = x;
+
+    return x >> 24;
 }
 
 /**
  * @brief Fetch the next instruction specified by the program counter, then
  * increment the PC.
  *
+ * @param state The machine to fetch from.
  * @return uint16_t The instruction to execute.
  */
-uint16_t fetch() {
-    uint16_t instruction = (memory[program_counter] << 8) | memory[program_counter + 1];
-    program_counter += 2;
+uint16_t fetch(Chip8State& state) {
+    uint16_t instruction = (state.memory[state.program_counter] << 8) | state.memory[state.program_counter + 1];
+    state.program_counter += 2;
 
     return instruction;
 }
@@ -132,13 +212,11 @@ bool test_instr_nibble(uint16_t instr_bytes, int nib_index, uint8_t nib_val) {
 Instruction decode(uint16_t instr_bytes) {
     struct Instruction instr;
 
-    // Collect potential instruction arguments for later use in execution.
-    instr.n = instr_bytes & 0x000F;
-    instr.nn = instr_bytes & 0x00FF;
-    instr.nnn = instr_bytes & 0x0FFF;
+    // Not every branch below recognizes all of its variants (e.g. 8XY8).
+    instr.op_id = OP_UNDEFINED;
 
-    instr.x = (instr_bytes & 0x0F00) >> 8;
-    instr.y = (instr_bytes & 0x00F0) >> 4;
+    // The arguments are extracted from the raw bytes when they are used.
+    instr.raw = instr_bytes;
 
     if (test_instr_nibble(instr_bytes, 3, 0x0)) {
         if (test_instr_nibble(instr_bytes, 2, 0x0)) {
@@ -252,7 +330,7 @@ Instruction decode(uint16_t instr_bytes) {
         // FX65
         instr.op_id = OP_READ_REGS;
     } else {
-        std::cerr << "Could not identify opcode." << std::endl;
+        log_err("Could not identify opcode.");
         instr.op_id = OP_UNDEFINED;
     }
 
@@ -262,122 +340,123 @@ Instruction decode(uint16_t instr_bytes) {
 /**
  * @brief Execute the decoded instruction with the provided arguments.
  *
+ * @param state The machine to execute the instruction on.
  * @param instr The instruction context containing which instruction to execute
  * and which arguments are used.
  */
-void execute(Instruction instr) {
+void execute(Chip8State& state, Instruction instr) {
     switch (instr.op_id)
     {
     case OP_EXEC_ROUTINE:
-        opcode_execute_routine(instr);
+        opcode_execute_routine(state, instr);
         break;
     case OP_CLEAR_SCREEN:
-        opcode_clear_screen(instr);
+        opcode_clear_screen(state, instr);
         break;
     case OP_JUMP_SUBR:
-        opcode_jump_subr(instr);
+        opcode_jump_subr(state, instr);
         break;
     case OP_JUMP_ADDR:
-        opcode_jump_address(instr);
+        opcode_jump_address(state, instr);
         break;
     case OP_RETURN:
-        opcode_return(instr);
+        opcode_return(state, instr);
         break;
     case OP_CALL_SUBR:
-        opcode_call_subr(instr);
+        opcode_call_subr(state, instr);
         break;
     case OP_SKIP_VAL_EQ:
-        opcode_skip_val_eq(instr);
+        opcode_skip_val_eq(state, instr);
         break;
     case OP_SKIP_VAL_NEQ:
-        opcode_skip_val_neq(instr);
+        opcode_skip_val_neq(state, instr);
         break;
     case OP_SKIP_REG_EQ:
-        opcode_skip_reg_eq(instr);
+        opcode_skip_reg_eq(state, instr);
         break;
     case OP_SKIP_REQ_NEQ:
-        opcode_skip_reg_neq(instr);
+        opcode_skip_reg_neq(state, instr);
         break;
     case OP_SET_INDEX:
-        opcode_set_index(instr);
+        opcode_set_index(state, instr);
         break;
     case OP_SET_X:
-        opcode_set_x(instr);
+        opcode_set_x(state, instr);
         break;
     case OP_ADD_X:
-        opcode_add_x(instr);
+        opcode_add_x(state, instr);
         break;
     case OP_ADD_X_TO_Y:
-        opcode_add_x_to_y(instr);
+        opcode_add_x_to_y(state, instr);
         break;
     case OP_SET_X_Y:
-        opcode_set_x_y(instr);
+        opcode_set_x_y(state, instr);
         break;
     case OP_OR:
-        opcode_or(instr);
+        opcode_or(state, instr);
         break;
     case OP_AND:
-        opcode_and(instr);
+        opcode_and(state, instr);
         break;
     case OP_XOR:
-        opcode_xor(instr);
+        opcode_xor(state, instr);
         break;
     case OP_ADD_Y_TO_X:
-        opcode_add_y_to_x(instr);
+        opcode_add_y_to_x(state, instr);
         break;
     case OP_SUB_Y_X:
-        opcode_sub_y_from_x(instr);
+        opcode_sub_y_from_x(state, instr);
         break;
     case OP_SUB_X_Y:
-        opcode_sub_x_from_y(instr);
+        opcode_sub_x_from_y(state, instr);
         break;
     case OP_SHIFT_RIGHT:
-        opcode_shift_right(instr);
+        opcode_shift_right(state, instr);
         break;
     case OP_SHIFT_LEFT:
-        opcode_shift_left(instr);
+        opcode_shift_left(state, instr);
         break;
     case OP_JUMP_OFFSET:
-        opcode_jump_offset(instr);
+        opcode_jump_offset(state, instr);
         break;
     case OP_SET_X_RAND:
-        opcode_set_x_random(instr);
+        opcode_set_x_random(state, instr);
         break;
     case OP_DRAW:
-        opcode_draw(instr);
+        opcode_draw(state, instr);
         break;
     case OP_SKIP_KP:
-        opcode_skip_kp(instr);
+        opcode_skip_kp(state, instr);
         break;
     case OP_SKIP_NOT_KP:
-        opcode_skip_not_kp(instr);
+        opcode_skip_not_kp(state, instr);
         break;
     case OP_SET_X_DELAY:
-        opcode_set_x_to_delay(instr);
+        opcode_set_x_to_delay(state, instr);
         break;
     case OP_WAIT_KP:
-        opcode_wait_keypress(instr);
+        opcode_wait_keypress(state, instr);
         break;
     case OP_SET_DELAY_X:
-        opcode_set_delay_to_x(instr);
+        opcode_set_delay_to_x(state, instr);
         break;
     case OP_SET_SOUND_X:
-        opcode_set_sound_to_x(instr);
+        opcode_set_sound_to_x(state, instr);
         break;
     case OP_ADD_X_I:
-        opcode_add_x_to_index(instr);
+        opcode_add_x_to_index(state, instr);
         break;
     case OP_SET_I_SPRITE:
-        opcode_set_index_sprite(instr);
+        opcode_set_index_sprite(state, instr);
         break;
     case OP_WRITE_BCD:
-        opcode_write_bcd(instr);
+        opcode_write_bcd(state, instr);
         break;
     case OP_WRITE_REGS:
-        opcode_write_regs(instr);
+        opcode_write_regs(state, instr);
         break;
     case OP_READ_REGS:
-        opcode_read_regs(instr);
+        opcode_read_regs(state, instr);
         break;
     default:
         break;
@@ -385,39 +464,153 @@ void execute(Instruction instr) {
 }
 
 /**
- * @brief Updates the delay and sound timers according to passed emulator time.
+ * @brief Advance a timer accumulator by some emulated time.
+ *
+ * @param timer_accum Emulated time (ms) not yet accounted for by the timers.
+ * @param time_delta_ms Emulated time that has passed.
+ * @return int How many times the 60Hz timers should be decremented.
  */
-void update_clocks(double time_delta_ms) {
+int advance_timer_accum(float& timer_accum, double time_delta_ms) {
     timer_accum += time_delta_ms;
 
     double time_per_update = 1000.f / TIMER_DEC_RATE;
     int decrement_count = std::floor(timer_accum / time_per_update);
 
+    if (timer_accum < time_per_update) {
+        return 0;
+    }
 
-    // Update the sound and delay timer accordingly.
-    if (timer_accum >= time_per_update) {
-        timer_accum -= time_per_update * decrement_count;
+    timer_accum -= time_per_update * decrement_count;
+
+    return decrement_count;
+}
+
+/**
+ * @brief Updates the delay and sound timers according to passed emulator time.
+ */
+void update_clocks(Chip8State& state, double time_delta_ms) {
+    int decrement_count = advance_timer_accum(state.timer_accum, time_delta_ms);
 
+    // Update the sound and delay timer accordingly.
+    if (decrement_count > 0) {
         // Prevents underflow
-        sound_timer = sound_timer < decrement_count ? 0 : sound_timer - decrement_count;
-        delay_timer = delay_timer < decrement_count ? 0 : delay_timer - decrement_count;
+        state.sound_timer = state.sound_timer < decrement_count ? 0 : state.sound_timer - decrement_count;
+        state.delay_timer = state.delay_timer < decrement_count ? 0 : state.delay_timer - decrement_count;
     }
 }
 
 /**
  * @brief The main CPU loop, handles fetching, decoding and execution.
  *
+ * @param state The machine to advance by one instruction.
  */
-void cpu_execute_instruction() {
-    // The fetch-decode-execute lines
-    uint16_t opcode = fetch();
+void cpu_execute_instruction(Chip8State& state) {
+    // A faulted machine executes nothing, only the time passes.
+    if (!state.fault) {
+        // The fetch-decode-execute lines
+        uint16_t opcode = fetch(state);
 
-    log_info(std::format("PC={:04X}; OPCODE={:04X}", program_counter - 2, opcode));
+        log_info("PC={:04X}; OPCODE={:04X}", state.program_counter - 2, opcode);
 
-    Instruction instr = decode(opcode);
+        Instruction instr = decode(opcode);
 
-    execute(instr);
+        execute(state, instr);
+    }
 
     // Update the sound and delay timer
-    update_clocks(1000.f / (TIMER_FREQ * INSTR_PER_FRAME));
+    update_clocks(state, 1000.f / (TIMER_FREQ * INSTR_PER_FRAME));
+}
+
+/**
+ * @brief Execute one frame worth of instructions (1/60th of a second) and
+ * reset the key releases afterwards, like the GUI does between frames.
+ * Instructions come from a per thread predecode cache, which gives the same
+ * result as calling cpu_execute_instruction() for each of them.
+ *
+ * @param state The machine to advance by one frame.
+ * @param sound Optional, receives the audio of the frame.
+ */
+void cpu_execute_frame(Chip8State& state, SoundRenderer* sound) {
+    thread_local PredecodeCache cache;
+
+    for (int executed = 0; executed < INSTR_PER_FRAME;) {
+        executed += cpu_execute_predecoded(state, cache, INSTR_PER_FRAME - executed, sound);
+    }
+
+    for (int i = 0; i < 16; i++) {
+        state.keys_released[i] = false;
+    }
+}
+
+// XXH64 primes
+const uint64_t XXH_PRIME_1 = 0x9E3779B185EBCA87;
+const uint64_t XXH_PRIME_2 = 0xC2B2AE3D27D4EB4F;
+const uint64_t XXH_PRIME_3 = 0x165667B19E3779F9;
+const uint64_t XXH_PRIME_4 = 0x85EBCA77C2B2AE63;
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME_2;
+    acc = std::rotl(acc, 31);
+
+    return acc * XXH_PRIME_1;
+}
+
+static inline uint64_t xxh_merge_round(uint64_t hash, uint64_t val) {
+    hash ^= xxh_round(0, val);
+
+    return hash * XXH_PRIME_1 + XXH_PRIME_4;
+}
+
+/**
+ * @brief Hash the contents of the pixel buffer. Two machines showing the same
+ * picture produce the same hash. This is XXH64 (seed 0) of the 32 rows
+ * stored as little endian 64bit words; the packed screen is exactly eight
+ * 32 byte stripes, so it is computed without any tail handling.
+ *
+ * @param state The machine whose screen to hash.
+ * @return uint64_t The hash of the screen.
+ */
+uint64_t cpu_framebuffer_hash(const Chip8State& state) {
+    const uint64_t* rows = state.pixel_buffer;
+
+    uint64_t v1 = XXH_PRIME_1 + XXH_PRIME_2;
+    uint64_t v2 = XXH_PRIME_2;
+    uint64_t v3 = 0;
+    uint64_t v4 = 0 - XXH_PRIME_1;
+
+    for (int i = 0; i < 32; i += 4) {
+        v1 = xxh_round(v1, rows[i]);
+        v2 = xxh_round(v2, rows[i + 1]);
+        v3 = xxh_round(v3, rows[i + 2]);
+        v4 = xxh_round(v4, rows[i + 3]);
+    }
+
+    uint64_t hash = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+    hash = xxh_merge_round(hash, v1);
+    hash = xxh_merge_round(hash, v2);
+    hash = xxh_merge_round(hash, v3);
+    hash = xxh_merge_round(hash, v4);
+
+    hash += sizeof(state.pixel_buffer);
+
+    // Avalanche
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME_2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME_3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+/**
+ * @brief Describe a fault in messages, e.g. "stack overflow".
+ */
+const char* cpu_fault_name(CpuFault fault) {
+    switch (fault)
+    {
+    case FAULT_STACK_OVERFLOW: return "stack overflow";
+    case FAULT_STACK_UNDERFLOW: return "stack underflow";
+    default: return "none";
+    }
 }
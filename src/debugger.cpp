@@ -0,0 +1,245 @@
+#include <bit>
+
+#include "debugger.h"
+#include "cpu.h"
+#include "audio.h"
+
+
+/**
+ * @brief Set or clear the breakpoint at an address.
+ *
+ * @param breakpoints The breakpoints to change.
+ * @param address Address of the instruction to break on.
+ * @param enabled Whether the breakpoint should be set.
+ */
+void breakpoint_set(Breakpoints& breakpoints, uint16_t address, bool enabled) {
+    if (breakpoint_at(breakpoints, address) == enabled) {
+        return;
+    }
+
+    address &= ADDRESS_MASK;
+
+    breakpoints.pc_bitmap[address / 64] ^= 1ull << (address % 64);
+    breakpoints.pc_count += enabled ? 1 : -1;
+}
+
+/**
+ * @brief Break before any instruction of an opcode class, e.g. every DXYN.
+ *
+ * @param breakpoints The breakpoints to change.
+ * @param op_id The opcode class.
+ * @param enabled Whether to break on it.
+ */
+void breakpoint_set_opcode(Breakpoints& breakpoints, Opcode op_id, bool enabled) {
+    if (enabled) {
+        breakpoints.opcode_classes |= 1ull << op_id;
+    } else {
+        breakpoints.opcode_classes &= ~(1ull << op_id);
+    }
+}
+
+/**
+ * @brief Add all breakpoints and watchpoints of one set to another.
+ *
+ * @param into The breakpoints to add to.
+ * @param from The breakpoints to add.
+ */
+void breakpoints_merge(Breakpoints& into, const Breakpoints& from) {
+    into.pc_count = 0;
+
+    for (int i = 0; i < MEMORY_SIZE / 64; i++) {
+        into.pc_bitmap[i] |= from.pc_bitmap[i];
+        into.pc_count += std::popcount(into.pc_bitmap[i]);
+    }
+
+    into.opcode_classes |= from.opcode_classes;
+    into.watchpoints.insert(into.watchpoints.end(), from.watchpoints.begin(), from.watchpoints.end());
+}
+
+/**
+ * @brief Read the current value of a watched location.
+ */
+static uint16_t watch_value(const Chip8State& state, const Watchpoint& watchpoint) {
+    switch (watchpoint.target)
+    {
+    case WATCH_MEMORY:
+        return state.memory[watchpoint.address];
+    case WATCH_REGISTER:
+        return state.registers[watchpoint.address & 0xF];
+    case WATCH_INDEX:
+        return state.index_register;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Add a watchpoint. The machine stops after any instruction that
+ * changes the value.
+ *
+ * @param breakpoints The breakpoints to add to.
+ * @param state The machine, for the current value.
+ * @param target What to watch.
+ * @param address Memory address or register number, ignored for the index
+ * register.
+ */
+void watchpoint_add(Breakpoints& breakpoints, const Chip8State& state, WatchTarget target, uint16_t address) {
+    Watchpoint watchpoint = {target, address, 0};
+    watchpoint.last_value = watch_value(state, watchpoint);
+
+    breakpoints.watchpoints.push_back(watchpoint);
+}
+
+/**
+ * @brief Check if the next instruction of the machine has a PC or opcode class
+ * breakpoint. Watchpoints are not checked.
+ *
+ * @param breakpoints The breakpoints to check.
+ * @param state The machine, about to execute its next instruction.
+ * @return BreakReason BREAK_PC, BREAK_OPCODE or BREAK_NONE.
+ */
+BreakReason breakpoint_hit(const Breakpoints& breakpoints, const Chip8State& state) {
+    if (breakpoint_at(breakpoints, state.program_counter)) {
+        return BREAK_PC;
+    }
+
+    if (breakpoints.opcode_classes != 0) {
+        uint16_t opcode = (state.memory[state.program_counter] << 8) | state.memory[state.program_counter + 1];
+
+        if ((breakpoints.opcode_classes >> decode(opcode).op_id) & 1) {
+            return BREAK_OPCODE;
+        }
+    }
+
+    return BREAK_NONE;
+}
+
+/**
+ * @brief The opcode classes decode() returns for some instruction word, as a
+ * mask like Breakpoints::opcode_classes. Not every Opcode is produced (e.g.
+ * OP_EXEC_ROUTINE), a breakpoint on those would never trigger.
+ */
+uint64_t decoded_opcode_classes() {
+    static const uint64_t classes = [] {
+        uint64_t mask = 0;
+
+        for (uint32_t word = 0; word <= 0xFFFF; word++) {
+            mask |= 1ull << decode((uint16_t) word).op_id;
+        }
+
+        return mask & ~(1ull << OP_UNDEFINED);
+    }();
+
+    return classes;
+}
+
+/**
+ * @brief Get a readable name of an opcode class, e.g. "DXYN DRW".
+ */
+const char* opcode_class_name(Opcode op_id) {
+    switch (op_id)
+    {
+    case OP_CLEAR_SCREEN: return "00E0 CLS";
+    case OP_JUMP_SUBR: return "0NNN SYS";
+    case OP_JUMP_ADDR: return "1NNN JP";
+    case OP_RETURN: return "00EE RET";
+    case OP_CALL_SUBR: return "2NNN CALL";
+    case OP_SKIP_VAL_EQ: return "3XNN SE";
+    case OP_SKIP_VAL_NEQ: return "4XNN SNE";
+    case OP_SKIP_REG_EQ: return "5XY0 SE";
+    case OP_SKIP_REQ_NEQ: return "9XY0 SNE";
+    case OP_SET_X: return "6XNN LD";
+    case OP_ADD_X: return "7XNN ADD";
+    case OP_SET_X_Y: return "8XY0 LD";
+    case OP_OR: return "8XY1 OR";
+    case OP_AND: return "8XY2 AND";
+    case OP_XOR: return "8XY3 XOR";
+    case OP_ADD_Y_TO_X: return "8XY4 ADD";
+    case OP_SUB_Y_X: return "8XY5 SUB";
+    case OP_SHIFT_RIGHT: return "8XY6 SHR";
+    case OP_SUB_X_Y: return "8XY7 SUBN";
+    case OP_SHIFT_LEFT: return "8XYE SHL";
+    case OP_SET_INDEX: return "ANNN LD I";
+    case OP_JUMP_OFFSET: return "BNNN JP V0";
+    case OP_SET_X_RAND: return "CXNN RND";
+    case OP_DRAW: return "DXYN DRW";
+    case OP_SKIP_KP: return "EX9E SKP";
+    case OP_SKIP_NOT_KP: return "EXA1 SKNP";
+    case OP_SET_X_DELAY: return "FX07 LD Vx, DT";
+    case OP_WAIT_KP: return "FX0A LD Vx, K";
+    case OP_SET_DELAY_X: return "FX15 LD DT";
+    case OP_SET_SOUND_X: return "FX18 LD ST";
+    case OP_ADD_X_I: return "FX1E ADD I";
+    case OP_SET_I_SPRITE: return "FX29 LD F";
+    case OP_WRITE_BCD: return "FX33 LD B";
+    case OP_WRITE_REGS: return "FX55 LD [I]";
+    case OP_READ_REGS: return "FX65 LD Vx, [I]";
+    default: return "Undefined";
+    }
+}
+
+const char* break_reason_name(BreakReason reason) {
+    switch (reason)
+    {
+    case BREAK_PC: return "breakpoint";
+    case BREAK_OPCODE: return "opcode breakpoint";
+    case BREAK_WATCH: return "watchpoint";
+    case BREAK_FAULT: return "fault";
+    default: return "none";
+    }
+}
+
+/**
+ * @brief Execute instructions like cpu_execute_instruction(), but stop at
+ * breakpoints and watchpoints. This is a separate loop so that runs without
+ * any breakpoints (see breakpoints_active()) pay nothing for them.
+ *
+ * Breakpoints stop before the instruction is executed, watchpoints and faults
+ * after the instruction that changed the value or faulted.
+ *
+ * @param state The machine to run.
+ * @param breakpoints Where to stop. The watched values are updated.
+ * @param count The maximum amount of instructions to execute.
+ * @param resume Don't check the breakpoints of the first instruction, to
+ * continue from the instruction the machine stopped at.
+ * @param sound Optional, receives the audio of every executed instruction.
+ * @return DebugRunResult How many instructions were executed, and why it
+ * stopped.
+ */
+DebugRunResult debug_run(Chip8State& state, Breakpoints& breakpoints, int count, bool resume, SoundRenderer* sound) {
+    for (int i = 0; i < count; i++) {
+        if (i > 0 || !resume) {
+            BreakReason reason = breakpoint_hit(breakpoints, state);
+
+            if (reason != BREAK_NONE) {
+                return {i, reason};
+            }
+        }
+
+        cpu_execute_instruction(state);
+
+        if (sound) {
+            sound->add_instruction(state.sound_timer > 0);
+        }
+
+        bool changed = false;
+        for (Watchpoint& watchpoint : breakpoints.watchpoints) {
+            uint16_t value = watch_value(state, watchpoint);
+
+            if (value != watchpoint.last_value) {
+                watchpoint.last_value = value;
+                changed = true;
+            }
+        }
+
+        if (state.fault) {
+            return {i + 1, BREAK_FAULT};
+        }
+
+        if (changed) {
+            return {i + 1, BREAK_WATCH};
+        }
+    }
+
+    return {count, BREAK_NONE};
+}
@@ -0,0 +1,116 @@
+#include <format>
+
+#include "disassembler.h"
+#include "cpu.h"
+
+
+/**
+ * @brief Get the assembly text of a decoded instruction, in the usual CHIP8
+ * mnemonics (SE, LD, DRW, ...). Words that do not decode are shown as data.
+ *
+ * @param instr The instruction as returned by decode().
+ * @return std::string The assembly text.
+ */
+std::string disassemble(Instruction instr) {
+    switch (instr.op_id)
+    {
+    case OP_EXEC_ROUTINE:
+    case OP_JUMP_SUBR:
+        return std::format("SYS  {:03X}", instr.nnn());
+    case OP_CLEAR_SCREEN:
+        return "CLS";
+    case OP_RETURN:
+        return "RET";
+    case OP_JUMP_ADDR:
+        return std::format("JP   {:03X}", instr.nnn());
+    case OP_CALL_SUBR:
+        return std::format("CALL {:03X}", instr.nnn());
+    case OP_SKIP_VAL_EQ:
+        return std::format("SE   V{:X}, {:02X}", instr.x(), instr.nn());
+    case OP_SKIP_VAL_NEQ:
+        return std::format("SNE  V{:X}, {:02X}", instr.x(), instr.nn());
+    case OP_SKIP_REG_EQ:
+        return std::format("SE   V{:X}, V{:X}", instr.x(), instr.y());
+    case OP_SKIP_REQ_NEQ:
+        return std::format("SNE  V{:X}, V{:X}", instr.x(), instr.y());
+    case OP_SET_X:
+        return std::format("LD   V{:X}, {:02X}", instr.x(), instr.nn());
+    case OP_ADD_X:
+        return std::format("ADD  V{:X}, {:02X}", instr.x(), instr.nn());
+    case OP_SET_X_Y:
+        return std::format("LD   V{:X}, V{:X}", instr.x(), instr.y());
+    case OP_OR:
+        return std::format("OR   V{:X}, V{:X}", instr.x(), instr.y());
+    case OP_AND:
+        return std::format("AND  V{:X}, V{:X}", instr.x(), instr.y());
+    case OP_XOR:
+        return std::format("XOR  V{:X}, V{:X}", instr.x(), instr.y());
+    case OP_ADD_X_TO_Y:
+    case OP_ADD_Y_TO_X:
+        return std::format("ADD  V{:X}, V{:X}", instr.x(), instr.y());
+    case OP_SUB_Y_X:
+        return std::format("SUB  V{:X}, V{:X}", instr.x(), instr.y());
+    case OP_SUB_X_Y:
+        return std::format("SUBN V{:X}, V{:X}", instr.x(), instr.y());
+    case OP_SHIFT_RIGHT:
+        return std::format("SHR  V{:X}, V{:X}", instr.x(), instr.y());
+    case OP_SHIFT_LEFT:
+        return std::format("SHL  V{:X}, V{:X}", instr.x(), instr.y());
+    case OP_SET_INDEX:
+        return std::format("LD   I, {:03X}", instr.nnn());
+    case OP_JUMP_OFFSET:
+        return std::format("JP   V0, {:03X}", instr.nnn());
+    case OP_SET_X_RAND:
+        return std::format("RND  V{:X}, {:02X}", instr.x(), instr.nn());
+    case OP_DRAW:
+        return std::format("DRW  V{:X}, V{:X}, {:X}", instr.x(), instr.y(), instr.n());
+    case OP_SKIP_KP:
+        return std::format("SKP  V{:X}", instr.x());
+    case OP_SKIP_NOT_KP:
+        return std::format("SKNP V{:X}", instr.x());
+    case OP_SET_X_DELAY:
+        return std::format("LD   V{:X}, DT", instr.x());
+    case OP_WAIT_KP:
+        return std::format("LD   V{:X}, K", instr.x());
+    case OP_SET_DELAY_X:
+        return std::format("LD   DT, V{:X}", instr.x());
+    case OP_SET_SOUND_X:
+        return std::format("LD   ST, V{:X}", instr.x());
+    case OP_ADD_X_I:
+        return std::format("ADD  I, V{:X}", instr.x());
+    case OP_SET_I_SPRITE:
+        return std::format("LD   F, V{:X}", instr.x());
+    case OP_WRITE_BCD:
+        return std::format("LD   B, V{:X}", instr.x());
+    case OP_WRITE_REGS:
+        return std::format("LD   [I], V{:X}", instr.x());
+    case OP_READ_REGS:
+        return std::format("LD   V{:X}, [I]", instr.x());
+    default:
+        return std::format("DW   {:04X}", instr.raw);
+    }
+}
+
+/**
+ * @brief Get the disassembly of the instruction starting at an address,
+ * decoding it only if the bytes there changed since the last call.
+ *
+ * @param memory The memory to disassemble.
+ * @param address Address of the first byte of the instruction.
+ * @return const std::string& The assembly text, valid until the next call
+ * for the same address.
+ */
+const std::string& Disassembler::line(const Memory& memory, uint16_t address) {
+    address &= ADDRESS_MASK;
+
+    uint16_t raw = memory[address] << 8 | memory[address + 1];
+    Line& line = m_lines[address];
+
+    if (!line.valid || line.raw != raw) {
+        line.raw = raw;
+        line.valid = true;
+        line.text = disassemble(decode(raw));
+    }
+
+    return line.text;
+}
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
 #include <iostream>
 #include <format>
 #include <SDL.h>
@@ -11,67 +14,133 @@
 #include "logger.h"
 #include "memory.h"
 #include "config.h"
+#include "audio.h"
+#include "phosphor.h"
+#include "profiler.h"
+#include "disassembler.h"
+#include "debugger.h"
 
 
 // Configurable options
 const int WINDOW_HEIGHT = 720;
 const int WINDOW_WIDTH = 1280;
 
-const int EMU_SCALE = 5;
-const int EMU_HEIGHT = 64;
-const int EMU_WIDTH = 128;
+// Part of the window the CHIP8 screen may fill (anchored top left), the rest
+// is left to the debugger windows.
+const float SCREEN_AREA_WIDTH = 0.5f;
+const float SCREEN_AREA_HEIGHT = 1.f;
 
+// Run commands that search for something (a draw, a PC) give up after this
+// many instructions.
+const uint64_t RUN_SEARCH_LIMIT = 100000000;
 
-// Sound
-bool beep_playing = false;
+// The timer pacing spins instead of sleeping for the last part of a frame,
+// SDL_Delay() can oversleep by about a millisecond.
+const double PACING_SPIN_MS = 2.0;
 
 
 /**
- * @brief Generate a beep noise.
+ * @brief Set the size of the audio device buffer in samples. Smaller buffers
+ * lower the delay between the sound timer changing and the beep being heard.
+ * Must be called before start_gui().
  */
-void generate_beep(void* userdata, Uint8* stream, int len_bytes) {
-    static double phase = 0.f;
-
-    // Audio wave characteristics
-    const double SOUND_AMP = 500;
-    const double SOUND_TONE = 440; // Hz
+void GUI::set_audio_buffer_size(int samples) {
+    m_audio_buffer_samples = samples;
+}
 
-    Sint16* buffer = (Sint16*) stream;
+/**
+ * @brief Also write the emulated audio to a WAV (or .raw) file. Must be called
+ * before start_gui().
+ */
+void GUI::set_audio_capture(std::string path) {
+    m_audio_capture_path = path;
+}
 
-    int sample_count = len_bytes / sizeof(Sint16);
+/**
+ * @brief Record every emulated frame to a video file, see VideoRecorder for the
+ * formats. Must be called before start_gui().
+ */
+void GUI::set_video_capture(std::string path) {
+    m_video_capture_path = path;
+}
 
-    if (beep_playing) {
-        for(int i = 0; i < sample_count; i++) {
-            buffer[i] = SOUND_AMP * SDL_sin(phase * 2.0f * M_PI);
-            phase += SOUND_TONE / 44100;
+/**
+ * @brief Choose how the emulator loop is paced. Must be called before
+ * start_gui().
+ */
+void GUI::set_pacing(PacingMode pacing) {
+    m_pacing = pacing;
+}
 
-            if (phase >= 1.0f) {
-                phase -= 1.0f;
-            }
-        }
-    } else {
-        for(int i = 0; i < sample_count; i++) {
-            buffer[i] = 0;
-        }
-    }
+/**
+ * @brief Use a static analysis of the loaded ROM to mark subroutines, blocks
+ * and data in the disassembly. Must be called before start_gui().
+ */
+void GUI::set_rom_analysis(RomAnalysis analysis) {
+    m_analysis = std::move(analysis);
 }
 
 /**
- * @brief This function opens the audio devices and attaches a callback.
+ * @brief This function opens the audio device. There is no callback, the
+ * emulation loop renders the audio from emulated time and queues it with
+ * queue_audio().
  */
 void GUI::setup_audio() {
+    if (!m_audio_capture_path.empty() && !m_audio_capture.open(m_audio_capture_path, AUDIO_SAMPLE_RATE)) {
+        log_err(std::format("Could not create {}", m_audio_capture_path));
+    }
+
     // Define the audio specifications
     SDL_AudioSpec spec = {0};
-    spec.freq = 44100;
+    spec.freq = AUDIO_SAMPLE_RATE;
     spec.format = AUDIO_S16SYS;
     spec.channels = 1;
-    spec.samples = 4096;
-    spec.callback = generate_beep;
+    spec.samples = m_audio_buffer_samples;
+    spec.callback = NULL;
 
     // Retrieve the audio device ID
-    SDL_AudioDeviceID device_id = SDL_OpenAudioDevice(NULL, 0, &spec, NULL, 0);
+    m_audio_device = SDL_OpenAudioDevice(NULL, 0, &spec, NULL, 0);
+
+    if (m_audio_device == 0) {
+        log_err(std::format("Could not open audio device: {}", SDL_GetError()));
+        return;
+    }
 
-    SDL_PauseAudioDevice(device_id, 0); // Starts audio
+    SDL_PauseAudioDevice(m_audio_device, 0); // Starts audio
+}
+
+/**
+ * @brief Queue the audio rendered from emulated time since the last call. The
+ * queue is kept just above one device buffer: enough to not run dry on host
+ * jitter, but no more since everything in the queue is latency.
+ */
+void GUI::queue_audio() {
+    const int SAMPLES_PER_FRAME = AUDIO_SAMPLE_RATE / TIMER_FREQ;
+
+    // The capture only receives the emulated audio, not the padding below.
+    m_audio_capture.write(m_sound.samples(), m_sound.available());
+
+    if (m_audio_device == 0) {
+        m_sound.consume(m_sound.available());
+        return;
+    }
+
+    int queued = SDL_GetQueuedAudioSize(m_audio_device) / sizeof(int16_t);
+
+    if (queued > m_audio_buffer_samples + 2 * SAMPLES_PER_FRAME) {
+        // The host runs ahead of the audio device, drop the rendered audio.
+        m_sound.consume(m_sound.available());
+        return;
+    }
+
+    // About to run dry (e.g. while paused), top the queue up with silence.
+    int missing = m_audio_buffer_samples - queued - (int) m_sound.available();
+    if (missing > 0) {
+        m_sound.add_silence(missing);
+    }
+
+    SDL_QueueAudio(m_audio_device, m_sound.samples(), m_sound.available() * sizeof(int16_t));
+    m_sound.consume(m_sound.available());
 }
 
 /**
@@ -81,8 +150,18 @@ void GUI::setup_audio() {
 void GUI::setup_GUI() {
     SDL_Init(SDL_INIT_EVERYTHING);
 
-    m_window = SDL_CreateWindow("CHIP8 Emulator", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WINDOW_WIDTH, WINDOW_HEIGHT, SDL_WINDOW_SHOWN);
-    m_renderer = SDL_CreateRenderer(m_window, -1, 0);
+    m_window = SDL_CreateWindow("CHIP8 Emulator", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WINDOW_WIDTH, WINDOW_HEIGHT, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+
+    // Vsync only gives the right speed if the display refreshes at ~60Hz.
+    SDL_DisplayMode display_mode;
+    if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(m_window), &display_mode) == 0) {
+        m_display_refresh_rate = display_mode.refresh_rate;
+    }
+
+    m_vsync = m_pacing == PACING_VSYNC
+        || (m_pacing == PACING_AUTO && std::abs(m_display_refresh_rate - TIMER_FREQ) <= 1.f);
+
+    m_renderer = SDL_CreateRenderer(m_window, -1, m_vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
 
     if (m_renderer == NULL) {
         std::cerr << "Could not initialize renderer.\n" << std::endl;
@@ -104,6 +183,33 @@ void GUI::setup_GUI() {
     // Create a texture for the emulator screen
     m_chip8_texture = SDL_CreateTexture(m_renderer,
         SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING, 64, 32);
+    SDL_SetTextureScaleMode(m_chip8_texture, SDL_ScaleModeNearest);
+
+    update_layout();
+}
+
+/**
+ * @brief Fit the CHIP8 screen to the current window size. Uses the largest
+ * integer scale that fits, so every CHIP8 pixel is the same amount of window
+ * pixels. Only does work when the window size actually changed.
+ */
+void GUI::update_layout() {
+    int width, height;
+    SDL_GetWindowSize(m_window, &width, &height);
+
+    if (width == m_layout_width && height == m_layout_height) {
+        return;
+    }
+
+    m_layout_width = width;
+    m_layout_height = height;
+
+    SDL_RenderSetLogicalSize(m_renderer, width, height);
+
+    int scale = std::min((int) (width * SCREEN_AREA_WIDTH) / 64, (int) (height * SCREEN_AREA_HEIGHT) / 32);
+    scale = std::max(scale, 1);
+
+    m_screen_rect = {0, 0, 64 * scale, 32 * scale};
 }
 
 
@@ -112,6 +218,13 @@ void GUI::setup_GUI() {
  *
  */
 void GUI::close_GUI() {
+    if (m_audio_device != 0) {
+        SDL_CloseAudioDevice(m_audio_device);
+        m_audio_device = 0;
+    }
+
+    m_audio_capture.close();
+
     ImGui_ImplSDLRenderer2_Shutdown();
     ImGui_ImplSDL2_Shutdown();
     ImGui::DestroyContext();
@@ -128,42 +241,17 @@ void GUI::close_GUI() {
 }
 
 /**
- * @brief Write all pixel values of the CHIP8 graphics to the screen.
+ * @brief Write all pixel values of the CHIP8 graphics to the screen, blended
+ * with the previous frames if persistence is enabled.
  *
  */
 void GUI::write_CHIP8_buffer() {
     uint32_t colors[64 * 32];
 
-    for (int i = 0; i < 32; i++) {
-        for (int j = 0; j < 64; j++) {
-            if (pixel_buffer[i][j]) {
-                colors[i * 64 + j] = 0x346856;
-            } else {
-                colors[i * 64 + j] = 0x88C070;
-            }
-        }
-    }
+    phosphor_expand(m_phosphor, 0x346856, 0x88C070, colors);
 
     SDL_UpdateTexture(m_chip8_texture, nullptr, colors, 64 * sizeof(uint32_t));
-
-    bool center_screen = false;
-
-    if (center_screen) {
-    // This code centers the CHIP8 screen to the parent window.
-    SDL_Rect dest_rect{
-        (WINDOW_WIDTH / 2) - ((EMU_WIDTH * EMU_SCALE) / 2),
-        (WINDOW_HEIGHT / 2) - ((EMU_HEIGHT * EMU_SCALE) / 2),
-        EMU_WIDTH * EMU_SCALE, EMU_HEIGHT * EMU_SCALE};
-
-        SDL_RenderCopy(m_renderer, m_chip8_texture, NULL, &dest_rect);
-    } else {
-        SDL_Rect dest_rect{
-        0,
-        0,
-        EMU_WIDTH * EMU_SCALE, EMU_HEIGHT * EMU_SCALE};
-
-        SDL_RenderCopy(m_renderer, m_chip8_texture, NULL, &dest_rect);
-    }
+    SDL_RenderCopy(m_renderer, m_chip8_texture, NULL, &m_screen_rect);
 }
 
 void GUI::render_gui_controls() {
@@ -171,6 +259,10 @@ void GUI::render_gui_controls() {
 
     if(ImGui::Button(run_fast ? "Stop" : "Run")) {
         run_fast ^= true;
+
+        // Continue past the breakpoint the machine stopped at.
+        m_resume = run_fast;
+        m_break_reason = BREAK_NONE;
     }
 
     ImGui::SameLine();
@@ -179,21 +271,86 @@ void GUI::render_gui_controls() {
         execute_next = true;
     }
 
+    ImGui::SameLine();
+
+    // Going back pauses the machine, re-running it would overwrite the
+    // history that is being looked at.
+    if(ImGui::Button("Step back")) {
+        run_fast = false;
+
+        if (m_rewind.step_back(*m_state)) {
+            m_break_reason = BREAK_NONE;
+            phosphor_push(m_phosphor, m_state->pixel_buffer);
+        }
+    }
+
+    ImGui::SameLine();
+
+    if(ImGui::Button("Run back")) {
+        run_fast = false;
+
+        if (m_rewind.run_back(*m_state, m_breakpoints)) {
+            m_break_reason = breakpoint_hit(m_breakpoints, *m_state);
+            phosphor_push(m_phosphor, m_state->pixel_buffer);
+        } else {
+            m_break_reason = BREAK_NONE;
+        }
+    }
+
+    ImGui::Text(std::format("History: {} instructions", m_rewind.position() - m_rewind.oldest()).c_str());
+
+    ImGui::InputScalar("##run_count", ImGuiDataType_U32, &m_run_count_input);
+    ImGui::SameLine();
+    if(ImGui::Button("Run N")) {
+        request_run(m_run_count_input, Breakpoints());
+    }
+
+    if(ImGui::Button("Next frame")) {
+        request_run(INSTR_PER_FRAME - m_rewind.position() % INSTR_PER_FRAME, Breakpoints());
+    }
+
+    ImGui::SameLine();
+
+    if(ImGui::Button("Next draw")) {
+        Breakpoints stops;
+        breakpoint_set_opcode(stops, OP_DRAW, true);
+
+        request_run(RUN_SEARCH_LIMIT, stops);
+    }
+
+    ImGui::InputScalar("##run_until", ImGuiDataType_U16, &m_run_until_input, NULL, NULL, "%03X", ImGuiInputTextFlags_CharsHexadecimal);
+    ImGui::SameLine();
+    if(ImGui::Button("Run to PC")) {
+        Breakpoints stops;
+        breakpoint_set(stops, m_run_until_input, true);
+
+        request_run(RUN_SEARCH_LIMIT, stops);
+    }
+
+    ImGui::Checkbox("Wrap sprites", &m_state->quirks.wrap_sprites);
+
+    // Frames a pixel keeps glowing after it is erased, 1 is off.
+    ImGui::SliderInt("Persistence", &m_phosphor.frames, 1, PHOSPHOR_MAX_FRAMES);
+    ImGui::SliderFloat("Decay", &m_phosphor.decay, 0.f, 1.f);
+
     ImGui::End();
 }
 
 void GUI::render_gui_cpu() {
     ImGui::Begin("CPU");
 
-    ImGui::Checkbox("Sound?", &beep_playing);
-    ImGui::Text(std::format("Delay timer {:02X}", delay_timer).c_str());
-    ImGui::Text(std::format("Sound timer {:02X}", sound_timer).c_str());
+    bool sound_on = m_state->sound_timer > 0;
+    ImGui::BeginDisabled();
+    ImGui::Checkbox("Sound?", &sound_on);
+    ImGui::EndDisabled();
+    ImGui::Text(std::format("Delay timer {:02X}", m_state->delay_timer).c_str());
+    ImGui::Text(std::format("Sound timer {:02X}", m_state->sound_timer).c_str());
 
-    ImGui::Text(std::format("Program Counter {:02X}", program_counter).c_str());
-    ImGui::Text(std::format("Index register {:02X}", index_register).c_str());
+    ImGui::Text(std::format("Program Counter {:02X}", m_state->program_counter).c_str());
+    ImGui::Text(std::format("Index register {:02X}", m_state->index_register).c_str());
 
     for (int i = 0; i < 16; i++) {
-        ImGui::InputScalar(std::format("V{:01X}", i).c_str(), ImGuiDataType_U8, (registers + i));
+        ImGui::InputScalar(std::format("V{:01X}", i).c_str(), ImGuiDataType_U8, (m_state->registers + i));
     }
 
     ImGui::End();
@@ -207,38 +364,268 @@ void GUI::render_gui_memory() {
     ImGuiTableFlags flags = ImGuiTableFlags_RowBg;
     uint16_t address;
     if (ImGui::BeginTable("memory", 17, flags)) {
-        for (int row = 0; row < 256; row++) {
-            ImGui::TableNextRow();
+        // Only the visible rows are submitted, 64 KB of memory would
+        // otherwise be 4096 rows of 17 cells every frame.
+        ImGuiListClipper clipper;
+        clipper.Begin(MEMORY_SIZE / 16);
+
+        while (clipper.Step()) {
+            for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+                ImGui::TableNextRow();
+
+                ImGui::TableSetColumnIndex(0);
+                ImGui::Text(std::format("{:03X}x", row).c_str());
+                for (int col = 0; col < 16; col++) {
+                    address = row * 16 + col;
+
+                    ImGui::TableSetColumnIndex(col + 1);
+
+                    // Highlight memory containing positive values
+                    if (m_state->memory[address] > 0x0) {
+                        ImGui::TableSetBgColor(ImGuiTableBgTarget_CellBg, ImGui::GetColorU32(ImVec4(1.0f, 1.0f, 1.0f, 0.2f)));
+                    } else {
+                        ImGui::TableSetBgColor(ImGuiTableBgTarget_CellBg, ImGui::GetColorU32(ImVec4(1.0f, 1.0f, 1.0f, 0.0f)));
+                    }
+
+                    // Highlight where the PC is pointing in memory
+                    if (address == m_state->program_counter || address == (m_state->program_counter + 1)) {
+                        ImGui::TableSetBgColor(ImGuiTableBgTarget_CellBg, ImGui::GetColorU32(ImVec4(1.0f, 1.0f, 1.0f, 0.8f)));
+                    }
+
+                    if (address == m_state->index_register) {
+                        ImGui::TableSetBgColor(ImGuiTableBgTarget_CellBg, ImGui::GetColorU32(ImVec4(1.0f, 0.0f, 0.0f, 0.8f)));
+                    }
+
+                    ImGui::Text(std::format("{:02X}", m_state->memory[address]).c_str());
+                }
+            }
+        }
 
-            ImGui::TableSetColumnIndex(0);
-            ImGui::Text(std::format("{:02X}x", row).c_str());
-            for (int col = 0; col < 16; col++) {
-                address = row * 16 + col;
+        ImGui::EndTable();
+    }
 
-                ImGui::TableSetColumnIndex(col + 1);
+    ImGui::End();
+}
 
-                // Highlight memory containing positive values
-                if (memory[address] > 0x0) {
-                    ImGui::TableSetBgColor(ImGuiTableBgTarget_CellBg, ImGui::GetColorU32(ImVec4(1.0f, 1.0f, 1.0f, 0.2f)));
-                } else {
-                    ImGui::TableSetBgColor(ImGuiTableBgTarget_CellBg, ImGui::GetColorU32(ImVec4(1.0f, 1.0f, 1.0f, 0.0f)));
-                }
+void GUI::render_gui_pacing() {
+    ImGui::Begin("Frame pacing");
 
-                // Highlight where the PC is pointing in memory
-                if (address == program_counter || address == (program_counter + 1)) {
-                    ImGui::TableSetBgColor(ImGuiTableBgTarget_CellBg, ImGui::GetColorU32(ImVec4(1.0f, 1.0f, 1.0f, 0.8f)));
-                }
+    ImGui::Text(std::format("Mode: {}, display {} Hz", m_vsync ? "vsync" : "timer", m_display_refresh_rate).c_str());
+
+    // Mean and standard deviation of the time between frame starts.
+    float mean = 0.f;
+    for (float frame_time : m_frame_times) {
+        mean += frame_time;
+    }
+    mean /= FRAME_TIME_HISTORY;
+
+    float variance = 0.f;
+    float worst = 0.f;
+    for (float frame_time : m_frame_times) {
+        variance += (frame_time - mean) * (frame_time - mean);
+        worst = std::max(worst, std::abs(frame_time - 1000.f / TIMER_FREQ));
+    }
+    variance /= FRAME_TIME_HISTORY;
+
+    ImGui::Text(std::format("Frame time {:.2f} ms, jitter {:.3f} ms (worst {:.3f} ms)", mean, std::sqrt(variance), worst).c_str());
+    ImGui::PlotLines("##frame_times", m_frame_times, FRAME_TIME_HISTORY, m_frame_time_index, NULL, 0.f, 2 * 1000.f / TIMER_FREQ, ImVec2(0, 60));
+
+    ImGui::End();
+}
+
+/**
+ * @brief Show the disassembly around the program counter. One row per two
+ * bytes, aligned to the program counter. Only the visible rows are
+ * disassembled, so this stays cheap for a 64K address space.
+ */
+void GUI::render_gui_disassembly() {
+    ImGui::Begin("Disassembly");
+
+    ImGui::Checkbox("Follow PC", &m_follow_pc);
+
+    uint16_t pc = m_state->program_counter & ADDRESS_MASK;
+    int row_count = MEMORY_SIZE / 2;
+    int pc_row = pc / 2;
+
+    ImGui::BeginChild("listing");
+
+    float row_height = ImGui::GetTextLineHeightWithSpacing();
+
+    // Only scroll when the PC moved, so the listing can still be scrolled by
+    // hand while the machine is paused.
+    if (m_follow_pc && pc != m_listing_pc) {
+        ImGui::SetScrollFromPosY(ImGui::GetCursorStartPos().y + pc_row * row_height, 0.5f);
+        m_listing_pc = pc;
+    }
+
+    ImGuiListClipper clipper;
+    clipper.Begin(row_count, row_height);
+
+    while (clipper.Step()) {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+            uint16_t address = row * 2 + (pc & 1);
+
+            bool has_breakpoint = breakpoint_at(m_breakpoints, address);
 
-                if (address == index_register) {
-                    ImGui::TableSetBgColor(ImGuiTableBgTarget_CellBg, ImGui::GetColorU32(ImVec4(1.0f, 0.0f, 0.0f, 0.8f)));
+            // Mark what the static analysis found: subroutines, the start of
+            // basic blocks and bytes no path reaches.
+            const char* tag = "   ";
+            bool is_data = false;
+
+            if (!m_analysis.byte_kinds.empty()) {
+                if (m_analysis.calls.contains(address)) {
+                    tag = "sub";
+                } else if (m_analysis.blocks.contains(address)) {
+                    tag = "  >";
+                } else if (m_analysis.byte_kinds[address] == BYTE_DATA) {
+                    tag = "dat";
+                    is_data = true;
                 }
+            }
+
+            std::string instruction = is_data
+                ? std::format("DB   {:02X} {:02X}", m_state->memory[address], m_state->memory[address + 1])
+                : m_disassembler.line(m_state->memory, address);
+
+            // The ID after ### stays the same when the breakpoint marker changes.
+            std::string text = std::format("{} {} {:03X}  {:02X}{:02X}  {}###{}", has_breakpoint ? '*' : ' ', tag, address,
+                m_state->memory[address], m_state->memory[address + 1], instruction, address);
+
+            // Clicking a line toggles its breakpoint.
+            if (ImGui::Selectable(text.c_str(), address == pc)) {
+                breakpoint_set(m_breakpoints, address, !has_breakpoint);
+            }
+        }
+    }
+
+    ImGui::EndChild();
+
+    ImGui::End();
+}
+
+void GUI::render_gui_breakpoints() {
+    ImGui::Begin("Breakpoints");
+
+    if (m_break_reason == BREAK_FAULT) {
+        ImGui::Text(std::format("Stopped at {:03X}: {}", cpu_fault_address(*m_state), cpu_fault_name(m_state->fault)).c_str());
+    } else if (m_break_reason != BREAK_NONE) {
+        ImGui::Text(std::format("Stopped at {:03X}: {}", m_state->program_counter, break_reason_name(m_break_reason)).c_str());
+    }
+
+    ImGui::InputScalar("Address", ImGuiDataType_U16, &m_breakpoint_input, NULL, NULL, "%03X", ImGuiInputTextFlags_CharsHexadecimal);
+
+    if (ImGui::Button("Break at address")) {
+        breakpoint_set(m_breakpoints, m_breakpoint_input, true);
+    }
+
+    ImGui::SameLine();
+
+    if (ImGui::Button("Watch address")) {
+        watchpoint_add(m_breakpoints, *m_state, WATCH_MEMORY, m_breakpoint_input & ADDRESS_MASK);
+    }
+
+    ImGui::InputScalar("Register", ImGuiDataType_U8, &m_watch_register_input, NULL, NULL, "%X", ImGuiInputTextFlags_CharsHexadecimal);
+
+    if (ImGui::Button("Watch V")) {
+        watchpoint_add(m_breakpoints, *m_state, WATCH_REGISTER, m_watch_register_input & 0xF);
+    }
+
+    ImGui::SameLine();
+
+    if (ImGui::Button("Watch I")) {
+        watchpoint_add(m_breakpoints, *m_state, WATCH_INDEX, 0);
+    }
+
+    ImGui::SeparatorText("Breakpoints");
 
-                ImGui::Text(std::format("{:02X}", memory[address]).c_str());
+    for (int word = 0; word < MEMORY_SIZE / 64; word++) {
+        for (uint64_t bits = m_breakpoints.pc_bitmap[word]; bits != 0; bits &= bits - 1) {
+            uint16_t address = word * 64 + std::countr_zero(bits);
+
+            if (ImGui::SmallButton(std::format("x##pc{}", address).c_str())) {
+                breakpoint_set(m_breakpoints, address, false);
+            }
+
+            ImGui::SameLine();
+            ImGui::Text(std::format("{:03X}  {}", address, m_disassembler.line(m_state->memory, address)).c_str());
+        }
+    }
+
+    ImGui::SeparatorText("Watchpoints");
+
+    for (size_t i = 0; i < m_breakpoints.watchpoints.size(); i++) {
+        const Watchpoint& watchpoint = m_breakpoints.watchpoints[i];
+
+        if (ImGui::SmallButton(std::format("x##watch{}", i).c_str())) {
+            m_breakpoints.watchpoints.erase(m_breakpoints.watchpoints.begin() + i);
+            break;
+        }
+
+        ImGui::SameLine();
+
+        if (watchpoint.target == WATCH_MEMORY) {
+            ImGui::Text(std::format("[{:03X}] = {:02X}", watchpoint.address, watchpoint.last_value).c_str());
+        } else if (watchpoint.target == WATCH_REGISTER) {
+            ImGui::Text(std::format("V{:X} = {:02X}", watchpoint.address, watchpoint.last_value).c_str());
+        } else {
+            ImGui::Text(std::format("I = {:03X}", watchpoint.last_value).c_str());
+        }
+    }
+
+    if (ImGui::CollapsingHeader("Opcode classes")) {
+        for (int op = 0; op < OP_UNDEFINED; op++) {
+            if (!((decoded_opcode_classes() >> op) & 1)) {
+                continue;
+            }
+
+            bool enabled = (m_breakpoints.opcode_classes >> op) & 1;
+
+            if (ImGui::Checkbox(opcode_class_name((Opcode) op), &enabled)) {
+                breakpoint_set_opcode(m_breakpoints, (Opcode) op, enabled);
             }
         }
     }
 
-    ImGui::EndTable();
+    ImGui::End();
+}
+
+/**
+ * @brief Show how long every stage of the main loop takes. The median shows
+ * the normal cost, the 99th percentile the occasional slow frame.
+ */
+void GUI::render_gui_performance() {
+    ImGui::Begin("Performance");
+
+    ImGuiTableFlags flags = ImGuiTableFlags_RowBg;
+    if (ImGui::BeginTable("stages", 4, flags)) {
+        ImGui::TableSetupColumn("Stage");
+        ImGui::TableSetupColumn("p50 (us)");
+        ImGui::TableSetupColumn("p99 (us)");
+        ImGui::TableSetupColumn("History");
+        ImGui::TableHeadersRow();
+
+        for (const StageTimings& stage : m_perf) {
+            ImGui::TableNextRow();
+
+            ImGui::TableSetColumnIndex(0);
+            ImGui::Text(stage.name);
+            ImGui::TableSetColumnIndex(1);
+            ImGui::Text(std::format("{:.1f}", stage_percentile(stage, 50.f)).c_str());
+            ImGui::TableSetColumnIndex(2);
+            ImGui::Text(std::format("{:.1f}", stage_percentile(stage, 99.f)).c_str());
+            ImGui::TableSetColumnIndex(3);
+            ImGui::PlotHistogram(std::format("##{}", stage.name).c_str(), stage.samples, stage.count,
+                stage.count < PROFILE_HISTORY ? 0 : stage.next, NULL, 0.f, FLT_MAX, ImVec2(120, 20));
+        }
+
+        ImGui::EndTable();
+    }
+
+    // How many times faster than realtime the emulation itself could run.
+    float emulation_p50 = stage_percentile(m_perf[PERF_EMULATION], 50.f);
+    if (run_fast && emulation_p50 > 0.f) {
+        ImGui::Text(std::format("Emulation speed limit: {:.0f}x realtime", 1e6f / TIMER_FREQ / emulation_p50).c_str());
+    }
 
     ImGui::End();
 }
@@ -248,26 +635,41 @@ void GUI::render_gui_memory() {
  * pixels to the screen.
  */
 void GUI::render() {
-    ImGui_ImplSDLRenderer2_NewFrame();
-    ImGui_ImplSDL2_NewFrame();
-    ImGui::NewFrame();
-
-    // add imgui windows here
-    render_gui_cpu();
-    render_gui_controls();
-    render_gui_memory();
+    {
+        ScopedTimer timer(m_perf[PERF_GUI_LAYOUT]);
+
+        ImGui_ImplSDLRenderer2_NewFrame();
+        ImGui_ImplSDL2_NewFrame();
+        ImGui::NewFrame();
+
+        // add imgui windows here
+        render_gui_cpu();
+        render_gui_controls();
+        render_gui_memory();
+        render_gui_disassembly();
+        render_gui_breakpoints();
+        render_gui_pacing();
+        render_gui_performance();
+
+        // After creating all ImGui windows, this will finalize the ImGui render data
+        ImGui::Render();
+    }
 
-    // After creating all ImGui windows, this will finalize the ImGui render data
-    ImGui::Render();
+    {
+        ScopedTimer timer(m_perf[PERF_RENDER]);
 
-    SDL_RenderSetLogicalSize(m_renderer, WINDOW_WIDTH, WINDOW_HEIGHT);
+        SDL_RenderClear(m_renderer);
 
-    SDL_RenderClear(m_renderer);
+        write_CHIP8_buffer();
+        ImGui_ImplSDLRenderer2_RenderDrawData(ImGui::GetDrawData(), m_renderer);
+    }
 
-    write_CHIP8_buffer();
-    ImGui_ImplSDLRenderer2_RenderDrawData(ImGui::GetDrawData(), m_renderer);
+    {
+        // Includes the wait for the display refresh when using vsync.
+        ScopedTimer timer(m_perf[PERF_PRESENT]);
 
-    SDL_RenderPresent(m_renderer);
+        SDL_RenderPresent(m_renderer);
+    }
 }
 
 uint8_t GUI::translate_sdl_to_scancode(SDL_Scancode scancode) {
@@ -328,24 +730,37 @@ uint8_t GUI::translate_sdl_to_scancode(SDL_Scancode scancode) {
     }
 }
 
-void GUI::sync_with_clock(double frame_duration) {
-    static float time_to_delay_ms = 0.f;
-
-    time_to_delay_ms += (1000.f / TIMER_FREQ) - frame_duration;
-
-    // It is not possible to have a negative desired delay, so clamp it to 0.
-    if (time_to_delay_ms < 0) {
-        time_to_delay_ms = 0;
+/**
+ * @brief Wait until the start of the next frame with the high resolution
+ * clock. Sleeps while the deadline is far away and spins for the last
+ * PACING_SPIN_MS, so frames start within microseconds of their deadline.
+ *
+ * @param deadline Performance counter value at which the next frame starts,
+ * moved on by one frame.
+ */
+void GUI::sync_with_clock(uint64_t& deadline) {
+    const uint64_t frequency = SDL_GetPerformanceFrequency();
+    const uint64_t frame_period = frequency / TIMER_FREQ;
+    const uint64_t spin_period = frequency * PACING_SPIN_MS / 1000.0;
+
+    uint64_t now = SDL_GetPerformanceCounter();
+
+    // More than a frame behind (e.g. the window was dragged), don't try to
+    // catch up by running frames back to back.
+    if (now > deadline + frame_period) {
+        deadline = now + frame_period;
+        return;
     }
 
-    // Wait if necessary to keep timing, don't if the time has surpassed the FPS time.
-    if (time_to_delay_ms >= 1.f) {
-        int temp = (int) time_to_delay_ms;  // Casting done to round towards zero, which we need in this case
-
-        SDL_Delay(temp);
+    if (deadline > now + spin_period) {
+        SDL_Delay((uint32_t) ((deadline - now - spin_period) * 1000 / frequency));
+    }
 
-        time_to_delay_ms -= temp;
+    while (SDL_GetPerformanceCounter() < deadline) {
+        // Spin
     }
+
+    deadline += frame_period;
 }
 
 void GUI::handle_key_events() {
@@ -356,34 +771,144 @@ void GUI::handle_key_events() {
 
         if (e.type == SDL_QUIT) {
             running = false;
+        } else if (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+            update_layout();
         } else if (e.type == SDL_KEYDOWN) {
-            keys_pressed[translate_sdl_to_scancode(e.key.keysym.scancode)] = true;
+            m_state->keys_pressed[translate_sdl_to_scancode(e.key.keysym.scancode)] = true;
         } else if (e.type == SDL_KEYUP) {
-            keys_pressed[translate_sdl_to_scancode(e.key.keysym.scancode)] = false;
-            keys_released[translate_sdl_to_scancode(e.key.keysym.scancode)] = true;
+            m_state->keys_pressed[translate_sdl_to_scancode(e.key.keysym.scancode)] = false;
+            m_state->keys_released[translate_sdl_to_scancode(e.key.keysym.scancode)] = true;
         }
     }
 }
 
 
+/**
+ * @brief Ask run_emulator() to execute a run command before the next frame.
+ * Pauses the machine.
+ *
+ * @param limit Maximum amount of instructions to execute.
+ * @param stops Where to stop early, on top of the user's breakpoints.
+ */
+void GUI::request_run(uint64_t limit, const Breakpoints& stops) {
+    run_fast = false;
+
+    m_run_pending = true;
+    m_run_limit = limit;
+    m_run_stops = stops;
+}
+
+/**
+ * @brief Execute the requested run command in one go, without rendering in
+ * between. The sound renderer still gets every instruction, like when
+ * stepping, so the audio recording stays in sync. The first instruction is
+ * always executed, so running to the current PC runs until it comes back
+ * there.
+ */
+void GUI::run_command() {
+    Breakpoints stops = m_breakpoints;
+    breakpoints_merge(stops, m_run_stops);
+
+    m_break_reason = BREAK_NONE;
+
+    // Executed in batches that end on frame boundaries, so the rewind
+    // history keeps taking snapshots and every completed frame is handled
+    // like run_emulator() does between frames.
+    for (uint64_t executed = 0; executed < m_run_limit;) {
+        int to_frame_end = INSTR_PER_FRAME - m_rewind.position() % INSTR_PER_FRAME;
+        int batch = (int) std::min<uint64_t>(m_run_limit - executed, to_frame_end);
+
+        m_rewind.begin_batch(*m_state);
+        DebugRunResult result = debug_run(*m_state, stops, batch, executed == 0, &m_sound);
+        m_rewind.executed(result.executed);
+
+        executed += result.executed;
+
+        if (result.executed == to_frame_end) {
+            m_video_capture.add_frame(m_state->pixel_buffer);
+
+            for (int i = 0; i < 16; i++) {
+                m_state->keys_released[i] = false;
+            }
+        }
+
+        if (result.reason != BREAK_NONE) {
+            m_break_reason = result.reason;
+            break;
+        }
+    }
+
+    // Keep the values the user's watchpoints saw.
+    m_breakpoints.watchpoints.assign(stops.watchpoints.begin(), stops.watchpoints.begin() + m_breakpoints.watchpoints.size());
+
+    phosphor_push(m_phosphor, m_state->pixel_buffer);
+    m_run_pending = false;
+}
+
 void GUI::run_emulator() {
-    // Create an SDL timer to keep track of time
-    uint64_t frame_start_time, frame_end_time, frame_time_delta;
-    frame_time_delta = 0;
+    const char* stage_names[PERF_STAGE_COUNT] = {"Emulation", "ImGui layout", "Render", "Present", "Audio"};
+    for (int i = 0; i < PERF_STAGE_COUNT; i++) {
+        m_perf[i].name = stage_names[i];
+    }
+
+    const double counter_ms = 1000.0 / SDL_GetPerformanceFrequency();
+
+    uint64_t last_frame_start = SDL_GetPerformanceCounter();
+    uint64_t deadline = last_frame_start + SDL_GetPerformanceFrequency() / TIMER_FREQ;
 
     while (running) {
-        frame_start_time = SDL_GetTicks64();
+        // Keep the time between frame starts for the jitter statistics.
+        uint64_t frame_start = SDL_GetPerformanceCounter();
+        m_frame_times[m_frame_time_index] = (frame_start - last_frame_start) * counter_ms;
+        m_frame_time_index = (m_frame_time_index + 1) % FRAME_TIME_HISTORY;
+        last_frame_start = frame_start;
 
         // Decide how to execute instruction, depends on whether the
         // debugger is being used to step through or it's fast execution.
         if (run_fast) {
-            for (int i = 0; i < INSTR_PER_FRAME; i++) {
-                cpu_execute_instruction();
+            ScopedTimer timer(m_perf[PERF_EMULATION]);
+
+            m_rewind.begin_batch(*m_state);
+
+            if (breakpoints_active(m_breakpoints)) {
+                DebugRunResult result = debug_run(*m_state, m_breakpoints, INSTR_PER_FRAME, m_resume, &m_sound);
+                m_rewind.executed(result.executed);
+                m_resume = false;
+
+                if (result.reason != BREAK_NONE) {
+                    run_fast = false;
+                    m_break_reason = result.reason;
+                }
+            } else {
+                cpu_execute_frame(*m_state, &m_sound);
+                m_rewind.executed(INSTR_PER_FRAME);
+
+                if (m_state->fault) {
+                    run_fast = false;
+                    m_break_reason = BREAK_FAULT;
+                }
             }
+
+            m_video_capture.add_frame(m_state->pixel_buffer);
+            phosphor_push(m_phosphor, m_state->pixel_buffer);
         } else if (execute_next) {
-            cpu_execute_instruction();
+            ScopedTimer timer(m_perf[PERF_EMULATION]);
+
+            m_rewind.begin_batch(*m_state);
+            cpu_execute_instruction(*m_state);
+            m_rewind.executed(1);
+            m_sound.add_instruction(m_state->sound_timer > 0);
+            phosphor_push(m_phosphor, m_state->pixel_buffer);
+
+            if (m_state->fault) {
+                m_break_reason = BREAK_FAULT;
+            }
 
             execute_next = false;
+        } else if (m_run_pending) {
+            ScopedTimer timer(m_perf[PERF_EMULATION]);
+
+            run_command();
         }
 
         // Handle all of the rendering.
@@ -391,34 +916,43 @@ void GUI::run_emulator() {
 
         // Reset key releases
         for (int i = 0; i < 16; i++) {
-            keys_released[i] = false;
+            m_state->keys_released[i] = false;
         }
 
         // Check for key press and release events
         handle_key_events();
 
-        // Assumes this main loop runs at 60Hz
-        beep_playing = sound_timer > 0;
+        // Hand the audio of the executed instructions to the device.
+        {
+            ScopedTimer timer(m_perf[PERF_AUDIO]);
 
-        // Determine how much time has passed in this frame (in milliseconds)
-        frame_end_time = SDL_GetTicks64();
-        frame_time_delta = frame_end_time - frame_start_time;
+            queue_audio();
+        }
 
-        // Sync the loop, so it stays in sync with clock as closely as
-        // possible.
-        sync_with_clock(frame_time_delta);
+        // With vsync, presenting the frame in render() already waited for
+        // the display.
+        if (!m_vsync) {
+            sync_with_clock(deadline);
+        }
     }
 }
 
 
-void GUI::start_gui() {
+void GUI::start_gui(Chip8State& state) {
+    m_state = &state;
+    phosphor_push(m_phosphor, m_state->pixel_buffer);
+
+    if (!m_video_capture_path.empty() && !m_video_capture.open(m_video_capture_path)) {
+        log_err(std::format("Could not create {}", m_video_capture_path));
+    }
+
     // Initialize SDL, audio and other things.
     setup_GUI();
     setup_audio();
-    load_fonts();
 
     run_emulator();
 
     // If the emulator is closed, then clean up all the allocated resources.
+    m_video_capture.close();
     close_GUI();
 }
\ No newline at end of file
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include "headless.h"
+#include "runner.h"
+#include "audio.h"
+#include "wav_writer.h"
+#include "video_recorder.h"
+#include "cpu.h"
+#include "config.h"
+
+
+/**
+ * @brief Run a ROM for a fixed amount of frames without any throttling and
+ * write the requested outputs.
+ *
+ * @param options What to run and where to write the results.
+ * @return int Exit code.
+ */
+int run_headless(const HeadlessOptions& options) {
+    std::vector<uint8_t> rom;
+
+    if (!read_binary_file(options.rom_path, rom)) {
+        std::cerr << "Could not read ROM." << std::endl;
+        return 1;
+    }
+
+    std::unique_ptr<Chip8State> state = std::make_unique<Chip8State>();
+    state->quirks = options.quirks;
+    cpu_reset(*state, options.seed);
+
+    if (!cpu_load_rom(*state, rom.data(), rom.size())) {
+        std::cerr << "ROM does not fit in memory." << std::endl;
+        return 1;
+    }
+
+    WavWriter audio_out;
+    if (!options.audio_out.empty() && !audio_out.open(options.audio_out, AUDIO_SAMPLE_RATE)) {
+        std::cerr << std::format("Could not create {}", options.audio_out) << std::endl;
+        return 1;
+    }
+
+    VideoRecorder video_out;
+    if (!options.video_out.empty() && !video_out.open(options.video_out)) {
+        std::cerr << std::format("Could not create {}", options.video_out) << std::endl;
+        return 1;
+    }
+
+    // Regression hashes are written as the frames complete, the stream
+    // buffers them so the output does not slow down the emulation.
+    std::ofstream hash_file;
+    std::ostream* hash_out = nullptr;
+
+    if (options.hash_out == "-") {
+        hash_out = &std::cout;
+    } else if (!options.hash_out.empty()) {
+        hash_file.open(options.hash_out, std::ios::binary);
+
+        if (!hash_file) {
+            std::cerr << std::format("Could not create {}", options.hash_out) << std::endl;
+            return 1;
+        }
+
+        hash_out = &hash_file;
+    }
+
+    SoundRenderer sound;
+    SoundRenderer* sound_ptr = audio_out.is_open() ? &sound : nullptr;
+
+    auto start_time = std::chrono::steady_clock::now();
+    int exit_code = 0;
+    uint64_t frames_run = 0;
+
+    for (uint64_t frame = 0; frame < options.frames; frame++) {
+        cpu_execute_frame(*state, sound_ptr);
+
+        if (sound_ptr) {
+            audio_out.write(sound.samples(), sound.available());
+            sound.consume(sound.available());
+        }
+
+        video_out.add_frame(state->pixel_buffer);
+
+        if (hash_out) {
+            std::format_to(std::ostreambuf_iterator<char>(*hash_out), "{:016x}\n", cpu_framebuffer_hash(*state));
+        }
+
+        frames_run++;
+
+        if (state->fault) {
+            std::cerr << std::format("ROM stopped: {} at {:03X} in frame {}",
+                cpu_fault_name(state->fault), cpu_fault_address(*state), frame) << std::endl;
+            exit_code = 1;
+            break;
+        }
+    }
+
+    audio_out.close();
+    video_out.close();
+
+    if (hash_out && !hash_out->flush()) {
+        std::cerr << std::format("Could not write {}", options.hash_out) << std::endl;
+        exit_code = 1;
+    }
+
+    double elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    std::cerr << std::format("{} frames in {:.3f} s ({:.1f}x realtime)",
+        frames_run, elapsed_s, frames_run / TIMER_FREQ / std::max(elapsed_s, 1e-9)) << std::endl;
+
+    return exit_code;
+}
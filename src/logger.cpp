@@ -2,9 +2,13 @@
 #include <format>
 #include <iostream>
 #include <fstream>
+#include <mutex>
+
+#include "logger.h"
 
 
 std::ofstream log_file;
+std::mutex log_mutex;
 
 bool logging_enabled = false;
 
@@ -18,15 +22,18 @@ void close_log_file() {
 }
 
 /**
- * @brief Log informative messages to the desired output.
+ * @brief Write an already formatted informative message to the desired
+ * output. Use log_info() instead, which skips the formatting when logging is
+ * disabled.
  *
  * @param msg The message to log.
  */
-void log_info(std::string msg) {
-    if (!logging_enabled)
-        return;
-
+void write_log(const std::string& msg) {
     std::string complete_msg = std::format("LOG: {}", msg);
+
+    // Multiple emulator instances may log from different threads.
+    std::lock_guard<std::mutex> lock(log_mutex);
+
     std::cout << complete_msg << std::endl;
 
     log_file << complete_msg << std::endl;
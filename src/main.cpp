@@ -7,30 +7,48 @@
 #include <map>
 #include <stdint.h>
 #include <stdio.h>
+#include <cstdlib>
+#include <ctime>
+#include <algorithm>
+#include <vector>
+#include <bit>
+#include <climits>
 
+#ifndef CHIP8_HEADLESS_ONLY
 #include "gui.h"
+#endif
 #include "cpu.h"
 #include "memory.h"
 #include "logger.h"
+#include "runner.h"
+#include "batch.h"
+#include "headless.h"
+#include "analysis.h"
 
 
 const int ROM_MAX_SIZE = 4096;
+const int MAX_THREADS = 1024;
+const int MAX_BENCH_LANES = 65536;
+const int MIN_AUDIO_BUFFER = 256;
+const int MAX_AUDIO_BUFFER = 8192;
 
 
-void print_memory() {
-    for (int i = 0; i < 4096; i+=2) {
-        std::cout << std::format("{:04x}: {:02X}{:02X}", i, memory[i], memory[i+1]) << std::endl;
+void print_memory(const Chip8State& state) {
+    for (int i = 0; i < MEMORY_SIZE; i+=2) {
+        std::cout << std::format("{:04x}: {:02X}{:02X}", i, state.memory[i], state.memory[i+1]) << std::endl;
     }
 }
 
 
 /**
- * @brief Read a ROM into a memory array starting at mem_start.
+ * @brief Read a ROM into the memory of a machine starting at offset.
  *
+ * @param state The machine to load the ROM into.
  * @param filepath file path to the ROM
- * @param mem_start starting address of the memory array
+ * @param offset starting address of the ROM in memory
+ * @return size_t The size of the ROM.
  */
-void read_rom(std::string filepath, uint16_t offset) {
+size_t read_rom(Chip8State& state, std::string filepath, uint16_t offset) {
     std::ifstream file(filepath, std::ios_base::binary);
 
     if (!file) {
@@ -38,34 +56,210 @@ void read_rom(std::string filepath, uint16_t offset) {
         exit(1);
     }
 
-    file.read((char*) (memory + offset), ROM_MAX_SIZE);
+    std::vector<uint8_t> rom(std::min(ROM_MAX_SIZE, MEMORY_SIZE - offset));
+    file.read((char*) rom.data(), rom.size());
+
+    cpu_load_rom(state, rom.data(), file.gcount(), offset);
+
+    return file.gcount();
+}
+
+/**
+ * @brief Run a list of jobs headless on all cores and print the results.
+ *
+ * @param job_list_path Path of the job list, see read_job_list().
+ * @param thread_count Amount of worker threads, 0 uses all cores.
+ */
+int run_job_list(std::string job_list_path, int thread_count) {
+    std::vector<RunnerJob> jobs;
+
+    try {
+        jobs = read_job_list(job_list_path);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::vector<RunnerResult> results = run_jobs(jobs, thread_count);
+
+    print_job_results(jobs, results);
+
+    for (const RunnerResult& result : results) {
+        if (!result.ok) {
+            return 1;
+        }
+    }
+
+    return 0;
 }
 
 /**
  * @brief Handle graphics setup, arguments passed and initialize the emulator.
  */
 int main(int argc, char *argv[]) {
+#ifndef CHIP8_HEADLESS_ONLY
     GUI gui;
+#endif
     std::string rom_path;
 
-    open_log_file();
+    // Headless batch mode: chip8 --jobs <job_list> [--threads N]
+    if (argc >= 3 && std::string(argv[1]) == "--jobs") {
+        int thread_count = 0;
+
+        for (int i = 3; i < argc; i++) {
+            std::string arg = argv[i];
+            uint64_t value;
+
+            if (arg != "--threads") {
+                std::cerr << "Unknown option: " << arg << std::endl;
+
+                return 1;
+            }
+
+            if (i + 1 >= argc || !parse_number(argv[++i], 1, MAX_THREADS, value)) {
+                std::cerr << std::format("--threads needs a number from 1 to {}", MAX_THREADS) << std::endl;
+
+                return 1;
+            }
+
+            thread_count = (int) value;
+        }
+
+        return run_job_list(argv[2], thread_count);
+    }
+
+    // Lockstep benchmark: chip8 --bench-batch <rom> [lanes] [frames]
+    if (argc >= 3 && std::string(argv[1]) == "--bench-batch") {
+        uint64_t lane_count = 1024;
+        uint64_t frame_count = 600;
+
+        if (argc >= 4 && !parse_number(argv[3], 1, MAX_BENCH_LANES, lane_count)) {
+            std::cerr << std::format("The lane count must be a number from 1 to {}", MAX_BENCH_LANES) << std::endl;
+
+            return 1;
+        }
+
+        if (argc >= 5 && !parse_number(argv[4], 1, INT_MAX, frame_count)) {
+            std::cerr << "Invalid frame count: " << argv[4] << std::endl;
+
+            return 1;
+        }
+
+        return run_batch_benchmark(argv[2], (int) lane_count, (int) frame_count);
+    }
+
+    // Static analysis report: chip8 --analyze <rom>
+    if (argc >= 3 && std::string(argv[1]) == "--analyze") {
+        Chip8State state;
+        cpu_reset(state);
+        size_t rom_size = read_rom(state, argv[2], 0x200);
+
+        print_rom_analysis(analyze_rom(state.memory, rom_size), state.memory, std::cout);
+
+        return 0;
+    }
+
+    // Interactive or headless mode:
+    // chip8 [--headless] [--frames N] [--seed N] [--wrap-sprites]
+    //       [--audio-out <file>] [--audio-buffer <samples>]
+    //       [--video-out <file>] [--hash-out <file>]
+    //       [--pacing auto|vsync|timer] <rom_path>
+    HeadlessOptions options;
+    [[maybe_unused]] bool seed_given = false;
+
+#ifdef CHIP8_HEADLESS_ONLY
+    // Built without the window, see the chip8_headless target.
+    bool headless = true;
+#else
+    bool headless = false;
+#endif
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--headless") {
+            headless = true;
+        } else if (arg == "--frames" && has_value) {
+            if (!parse_number(argv[++i], 1, UINT64_MAX, options.frames)) {
+                std::cerr << "Invalid frame count: " << argv[i] << std::endl;
+
+                return 1;
+            }
+        } else if (arg == "--seed" && has_value) {
+            if (!parse_seed(argv[++i], options.seed)) {
+                std::cerr << "Invalid seed: " << argv[i] << std::endl;
+
+                return 1;
+            }
+
+            seed_given = true;
+        } else if (arg == "--wrap-sprites") {
+            options.quirks.wrap_sprites = true;
+        } else if (arg == "--audio-out" && has_value) {
+            options.audio_out = argv[++i];
+        } else if (arg == "--video-out" && has_value) {
+            options.video_out = argv[++i];
+        } else if (arg == "--hash-out" && has_value) {
+            options.hash_out = argv[++i];
+#ifndef CHIP8_HEADLESS_ONLY
+        } else if (arg == "--pacing" && has_value) {
+            std::string pacing = argv[++i];
+            gui.set_pacing(pacing == "vsync" ? PACING_VSYNC : pacing == "timer" ? PACING_TIMER : PACING_AUTO);
+        } else if (arg == "--audio-buffer" && has_value) {
+            uint64_t samples;
+
+            if (!parse_number(argv[++i], MIN_AUDIO_BUFFER, MAX_AUDIO_BUFFER, samples) || !std::has_single_bit(samples)) {
+                std::cerr << std::format("--audio-buffer needs a power of two from {} to {}", MIN_AUDIO_BUFFER, MAX_AUDIO_BUFFER) << std::endl;
+
+                return 1;
+            }
+
+            gui.set_audio_buffer_size((int) samples);
+#endif
+        } else {
+            rom_path = arg;
+        }
+    }
 
     // Check if a ROM path was provided.
-    if (argc != 2) {
-        log_err("No ROM provided, please provide a ROM path...");
+    if (rom_path.empty()) {
+        std::cerr << "No ROM provided, please provide a ROM path..." << std::endl;
 
         return 1;
-    } else {
-        rom_path = argv[1];
     }
 
+    if (headless) {
+        options.rom_path = rom_path;
+
+        return run_headless(options);
+    }
+
+#ifndef CHIP8_HEADLESS_ONLY
+    open_log_file();
+
     // Prime the memory with the provided ROM and font data.
-    read_rom(rom_path, 0x200);
+    Chip8State state;
+    state.quirks = options.quirks;
+    cpu_reset(state, seed_given ? options.seed : (uint32_t) time(NULL));
+    size_t rom_size = read_rom(state, rom_path, 0x200);
+
+    gui.set_rom_analysis(analyze_rom(state.memory, rom_size));
+
+    // Also write the audio to a file if requested.
+    if (!options.audio_out.empty()) {
+        gui.set_audio_capture(options.audio_out);
+    }
+
+    if (!options.video_out.empty()) {
+        gui.set_video_capture(options.video_out);
+    }
 
     // Start the graphical interface and the emulator with it
-    gui.start_gui();
+    gui.start_gui(state);
 
     close_log_file();
+#endif
 
     return 0;
 }
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <cstring>
+
+#include "memory.h"
+
+
+/**
+ * @brief Create a memory filled with zeroes. All pages start out as references
+ * to the same zero page, so a fresh machine does not allocate until written.
+ */
+Memory::Memory() {
+    clear();
+}
+
+/**
+ * @brief Get a page that may be written to, duplicating it first if it is
+ * shared with another Memory.
+ *
+ * @param page_index The index of the page.
+ * @return uint8_t* The bytes of the page.
+ */
+uint8_t* Memory::writable_page(int page_index) {
+    std::shared_ptr<Page>& page = m_pages[page_index];
+
+    if (page.use_count() > 1) {
+        page = std::make_shared<Page>(*page);
+    }
+
+    return page->bytes;
+}
+
+/**
+ * @brief Copy a block of bytes into memory, wrapping around at the end of the
+ * address space.
+ *
+ * @param address Start address of the block.
+ * @param data The bytes to copy.
+ * @param size Amount of bytes.
+ */
+void Memory::write_block(uint16_t address, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        address &= ADDRESS_MASK;
+
+        int offset = address % MEMORY_PAGE_SIZE;
+        size_t chunk = std::min(size, (size_t) (MEMORY_PAGE_SIZE - offset));
+
+        std::memcpy(writable_page(address / MEMORY_PAGE_SIZE) + offset, data, chunk);
+
+        address += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+/**
+ * @brief Zero the whole memory.
+ */
+void Memory::clear() {
+    static const std::shared_ptr<Page> zero_page = std::make_shared<Page>();
+
+    for (int i = 0; i < MEMORY_PAGE_COUNT; i++) {
+        m_pages[i] = zero_page;
+    }
+}
+
+/**
+ * @brief Check if a page is still shared with another memory, i.e. neither has
+ * written to it since they were forked.
+ */
+bool Memory::shares_page(const Memory& other, int page_index) const {
+    return m_pages[page_index] == other.m_pages[page_index];
+}
@@ -1,6 +1,8 @@
 #include <stdint.h>
 #include <cstdlib>
 #include <format>
+#include <algorithm>
+#include <bit>
 
 #include "logger.h"
 #include "cpu.h"
@@ -9,254 +11,266 @@
 #include <iostream>
 
 
-void opcode_execute_routine(Instruction instr) {};
+void opcode_execute_routine(Chip8State& state, Instruction instr) {};
 
-void opcode_clear_screen(Instruction instr) {
-    log_info(std::format("CLEAR_SCRN"));
+void opcode_clear_screen(Chip8State& state, Instruction instr) {
+    log_info("CLEAR_SCRN");
 
-    // TODO: It would be faster to copy a block of false values over this memory
-    // space, instead of looping over each value.
     for (int i = 0; i < 32; i++) {
-        for (int j = 0; j < 64; j++) {
-            pixel_buffer[i][j] = false;
-        }
+        state.pixel_buffer[i] = 0;
     }
 }
 
-void opcode_jump_subr(Instruction instr) {
-    log_info(std::format("JUMP_SUBR"));
+void opcode_jump_subr(Chip8State& state, Instruction instr) {
+    log_info("JUMP_SUBR");
     // Don't implement
 }
 
-void opcode_jump_address(Instruction instr) {
-    log_info(std::format("JUMP_ADDR 0x{:04X}", instr.nnn));
+void opcode_jump_address(Chip8State& state, Instruction instr) {
+    log_info("JUMP_ADDR 0x{:04X}", instr.nnn());
 
-    program_counter = instr.nnn;
+    state.program_counter = instr.nnn();
 }
 
-void opcode_return(Instruction instr) {
-    log_info(std::format("RETURN", instr.nnn));
+void opcode_return(Chip8State& state, Instruction instr) {
+    log_info("RETURN");
 
-    program_counter = pop_stack();
+    pop_stack(state, state.program_counter);
 }
 
-void opcode_call_subr(Instruction instr) {
-    log_info(std::format("CALL SUBR 0x{:04X}", instr.nnn));
+void opcode_call_subr(Chip8State& state, Instruction instr) {
+    log_info("CALL SUBR 0x{:04X}", instr.nnn());
 
-    push_stack(program_counter);
-    program_counter = instr.nnn;
+    if (push_stack(state, state.program_counter)) {
+        state.program_counter = instr.nnn();
+    }
 }
 
-void opcode_skip_val_eq(Instruction instr) {
-    log_info(std::format("SKIP? {:02X} == {:02X}", registers[instr.x], instr.nn));
+void opcode_skip_val_eq(Chip8State& state, Instruction instr) {
+    log_info("SKIP? {:02X} == {:02X}", state.registers[instr.x()], instr.nn());
 
-    if (registers[instr.x] == instr.nn) {
-        program_counter += 2;
+    if (state.registers[instr.x()] == instr.nn()) {
+        state.program_counter += 2;
     }
 }
 
-void opcode_skip_val_neq(Instruction instr) {
-    log_info(std::format("SKIP? {:02X} != {:02X}", registers[instr.x], instr.nn));
+void opcode_skip_val_neq(Chip8State& state, Instruction instr) {
+    log_info("SKIP? {:02X} != {:02X}", state.registers[instr.x()], instr.nn());
 
-    if (registers[instr.x] != instr.nn) {
-        program_counter += 2;
+    if (state.registers[instr.x()] != instr.nn()) {
+        state.program_counter += 2;
     }
 }
 
-void opcode_skip_reg_eq(Instruction instr) {
-    log_info(std::format("SKIP? {:02X} == {:02X}", registers[instr.x], registers[instr.y]));
+void opcode_skip_reg_eq(Chip8State& state, Instruction instr) {
+    log_info("SKIP? {:02X} == {:02X}", state.registers[instr.x()], state.registers[instr.y()]);
 
-    if (registers[instr.x] == registers[instr.y]) {
-        program_counter += 2;
+    if (state.registers[instr.x()] == state.registers[instr.y()]) {
+        state.program_counter += 2;
     }
 }
 
-void opcode_skip_reg_neq(Instruction instr) {
-    log_info(std::format("SKIP? {:02X} != {:02X}", registers[instr.x], registers[instr.y]));
+void opcode_skip_reg_neq(Chip8State& state, Instruction instr) {
+    log_info("SKIP? {:02X} != {:02X}", state.registers[instr.x()], state.registers[instr.y()]);
 
-    if (registers[instr.x] != registers[instr.y]) {
-        program_counter += 2;
+    if (state.registers[instr.x()] != state.registers[instr.y()]) {
+        state.program_counter += 2;
     }
 }
 
-void opcode_set_x(Instruction instr) {
-    log_info(std::format("SET REG({:02X}) = {:02X}", instr.x, instr.nn));
+void opcode_set_x(Chip8State& state, Instruction instr) {
+    log_info("SET REG({:02X}) = {:02X}", instr.x(), instr.nn());
 
-    registers[instr.x] = instr.nn;
+    state.registers[instr.x()] = instr.nn();
 }
 
-void opcode_add_x(Instruction instr) {
-    log_info(std::format("ADD REG({:02X}) = {:02X}", instr.x, instr.nn));
+void opcode_add_x(Chip8State& state, Instruction instr) {
+    log_info("ADD REG({:02X}) = {:02X}", instr.x(), instr.nn());
 
-    registers[instr.x] += instr.nn;
+    state.registers[instr.x()] += instr.nn();
 }
 
-void opcode_add_x_to_y(Instruction instr) {
-    log_info(std::format("ADD REG({:02X}) REG({:02X})", instr.y, instr.x));
+void opcode_add_x_to_y(Chip8State& state, Instruction instr) {
+    log_info("ADD REG({:02X}) REG({:02X})", instr.y(), instr.x());
 
-    registers[instr.y] += registers[instr.x];
+    state.registers[instr.y()] += state.registers[instr.x()];
 }
 
-void opcode_set_x_y(Instruction instr) {
-    log_info(std::format("SET REG({:02X}) = REG({:02X})", instr.x, instr.y));
+void opcode_set_x_y(Chip8State& state, Instruction instr) {
+    log_info("SET REG({:02X}) = REG({:02X})", instr.x(), instr.y());
 
-    registers[instr.x] = registers[instr.y];
+    state.registers[instr.x()] = state.registers[instr.y()];
 }
 
-void opcode_or(Instruction instr) {
-    log_info(std::format("OR REG({:02X}) REG({:02X})", instr.x, instr.y));
+void opcode_or(Chip8State& state, Instruction instr) {
+    log_info("OR REG({:02X}) REG({:02X})", instr.x(), instr.y());
 
-    registers[instr.x] = registers[instr.x] | registers[instr.y];
+    state.registers[instr.x()] = state.registers[instr.x()] | state.registers[instr.y()];
 }
 
-void opcode_and(Instruction instr) {
-    log_info(std::format("AND REG({:02X}) REG({:02X})", instr.x, instr.y));
+void opcode_and(Chip8State& state, Instruction instr) {
+    log_info("AND REG({:02X}) REG({:02X})", instr.x(), instr.y());
 
-    registers[instr.x] = registers[instr.x] & registers[instr.y];
+    state.registers[instr.x()] = state.registers[instr.x()] & state.registers[instr.y()];
 }
 
-void opcode_xor(Instruction instr) {
-    log_info(std::format("XOR REG({:02X}) REG({:02X})", instr.x, instr.y));
+void opcode_xor(Chip8State& state, Instruction instr) {
+    log_info("XOR REG({:02X}) REG({:02X})", instr.x(), instr.y());
 
-    registers[instr.x] = registers[instr.x] ^ registers[instr.y];
+    state.registers[instr.x()] = state.registers[instr.x()] ^ state.registers[instr.y()];
 }
 
-void opcode_add_y_to_x(Instruction instr) {
-    log_info(std::format("ADD REG({:02X}) REG({:02X})", instr.x, instr.y));
+void opcode_add_y_to_x(Chip8State& state, Instruction instr) {
+    log_info("ADD REG({:02X}) REG({:02X})", instr.x(), instr.y());
 
     // Test for overflow first by using a larger datatype.
-    int temp = registers[instr.x] + registers[instr.y];
+    int temp = state.registers[instr.x()] + state.registers[instr.y()];
     bool overflowed = temp > 0xFF;
 
-    registers[instr.x] += registers[instr.y];
+    state.registers[instr.x()] += state.registers[instr.y()];
 
     // Set flag register
-    registers[0xF] = overflowed;
+    state.registers[0xF] = overflowed;
 }
 
-void opcode_sub_y_from_x(Instruction instr) {
-    log_info(std::format("SUB REG({:02X}) REG({:02X})", instr.x, instr.y));
+void opcode_sub_y_from_x(Chip8State& state, Instruction instr) {
+    log_info("SUB REG({:02X}) REG({:02X})", instr.x(), instr.y());
 
-    uint8_t flag = registers[instr.y] <= registers[instr.x];
+    uint8_t flag = state.registers[instr.y()] <= state.registers[instr.x()];
 
-    registers[instr.x] = registers[instr.x] - registers[instr.y];
+    state.registers[instr.x()] = state.registers[instr.x()] - state.registers[instr.y()];
 
     // Set underflow flag
-    registers[0xF] = flag;
+    state.registers[0xF] = flag;
 }
 
-void opcode_sub_x_from_y(Instruction instr) {
-    log_info(std::format("SUB REG({:02X}) REG({:02X})", instr.y, instr.x));
+void opcode_sub_x_from_y(Chip8State& state, Instruction instr) {
+    log_info("SUB REG({:02X}) REG({:02X})", instr.y(), instr.x());
 
-    uint8_t flag = registers[instr.x] <= registers[instr.y];
+    uint8_t flag = state.registers[instr.x()] <= state.registers[instr.y()];
 
-    registers[instr.x] = registers[instr.y] - registers[instr.x];
+    state.registers[instr.x()] = state.registers[instr.y()] - state.registers[instr.x()];
 
     // Set underflow flag
-    registers[0xF] = flag;
+    state.registers[0xF] = flag;
 }
 
-void opcode_shift_right(Instruction instr) {
-    log_info(std::format("RSHIFT REG({:02X})", instr.y));
+void opcode_shift_right(Chip8State& state, Instruction instr) {
+    log_info("RSHIFT REG({:02X})", instr.y());
 
-    bool bit_out = (registers[instr.y] & 0b1) == 0b1;
+    bool bit_out = (state.registers[instr.y()] & 0b1) == 0b1;
 
-    registers[instr.x] = registers[instr.y] >> 1;
+    state.registers[instr.x()] = state.registers[instr.y()] >> 1;
 
     // Set flag register
-    registers[0xF] = bit_out;
+    state.registers[0xF] = bit_out;
 }
 
-void opcode_shift_left(Instruction instr) {
-    log_info(std::format("LSHIFT REG({:02X})", instr.y));
+void opcode_shift_left(Chip8State& state, Instruction instr) {
+    log_info("LSHIFT REG({:02X})", instr.y());
 
     // Check the most significant bit, is it on? Then set the flag register.
-    bool bit_out = (registers[instr.y] & 0b10000000) == 0b10000000;
+    bool bit_out = (state.registers[instr.y()] & 0b10000000) == 0b10000000;
 
-    registers[instr.x] = registers[instr.y] << 1;
+    state.registers[instr.x()] = state.registers[instr.y()] << 1;
 
     // Set flag register
-    registers[0xF] = bit_out;
+    state.registers[0xF] = bit_out;
 }
 
-void opcode_set_index(Instruction instr) {
-    log_info(std::format("SET INDEX = 0x{:04X}", instr.nnn));
+void opcode_set_index(Chip8State& state, Instruction instr) {
+    log_info("SET INDEX = 0x{:04X}", instr.nnn());
 
-    index_register = instr.nnn;
+    state.index_register = instr.nnn();
 }
 
-void opcode_jump_offset(Instruction instr) {
-    log_info(std::format("JUMP_OFFSET {:04X} + {:02X}", instr.nnn, registers[0]));
+void opcode_jump_offset(Chip8State& state, Instruction instr) {
+    log_info("JUMP_OFFSET {:04X} + {:02X}", instr.nnn(), state.registers[0]);
 
-    program_counter = instr.nnn + registers[0];
+    state.program_counter = instr.nnn() + state.registers[0];
 }
 
-void opcode_set_x_random(Instruction instr) {
-    log_info(std::format("SET_RAND"));
+void opcode_set_x_random(Chip8State& state, Instruction instr) {
+    log_info("SET_RAND");
 
-    registers[instr.x] = (rand() % 255) & instr.nn;
+    state.registers[instr.x()] = (cpu_random(state) % 255) & instr.nn();
 }
 
-void opcode_draw(Instruction instr) {
-    log_info(std::format("DRAW N={} X={} Y={}", instr.n, registers[instr.x], registers[instr.y]));
+/**
+ * @brief XOR a sprite onto the screen, shared by DXYN and the batch engine.
+ * Pixels past the right and bottom edge are clipped or wrapped around,
+ * depending on the quirk setting.
+ *
+ * @param state The machine to draw on.
+ * @param x Column of the top left pixel, taken modulo 64.
+ * @param y Row of the top left pixel, taken modulo 32.
+ * @param sprite_addr Address of the sprite, one byte per row.
+ * @param height Amount of rows.
+ * @return bool Whether a pixel that was on got turned off.
+ */
+bool draw_sprite(Chip8State& state, uint8_t x, uint8_t y, uint16_t sprite_addr, uint8_t height) {
+    uint8_t x_start = x % 64;
+    uint8_t y_start = y % 32;
+    bool collision = false;
 
-    uint8_t height = instr.n;
-    uint16_t sprite_addr = index_register;
-    uint8_t x_start = registers[instr.x] % 64;
-    uint8_t y_start = registers[instr.y] % 32;
+    // The sprite is always 8 bits/pixels wide.
+    bool wrap = state.quirks.wrap_sprites;
+    int row_count = wrap ? height : std::min((int) height, 32 - y_start);
 
-    // Reset the flag register
-    registers[0xF] = 0x0;
+    for (int row = 0; row < row_count; row++) {
+        uint64_t sprite_row = (uint64_t) state.memory[sprite_addr + row] << 56;
+        uint64_t sprite_mask = wrap ? std::rotr(sprite_row, x_start) : sprite_row >> x_start;
+        uint64_t& pixel_row = state.pixel_buffer[(y_start + row) % 32];
+
+        // Set flag to true if an activated pixel was flipped.
+        if (pixel_row & sprite_mask) {
+            collision = true;
+        }
 
-    // Write the sprite to the pixel buffer, it is always 8 bits/pixels wide.
-    uint8_t sprite_mask;
-    for (int row = 0; row < height; row++) {
-        uint8_t pixel_row = memory[sprite_addr + row];
+        pixel_row ^= sprite_mask;
+    }
 
-        for (int i = 0; i < 8; i++) {
-            sprite_mask = (pixel_row & (1 << (7 - i))) >> (7 - i);
+    return collision;
+}
 
-            // Set flag to true if an activated pixel was flipped.
-            if (pixel_buffer[y_start + row][x_start + i] & sprite_mask) {
-                registers[0xF] = 1;
-            }
+void opcode_draw(Chip8State& state, Instruction instr) {
+    log_info("DRAW N={} X={} Y={}", instr.n(), state.registers[instr.x()], state.registers[instr.y()]);
 
-            pixel_buffer[y_start + row][x_start + i] ^= sprite_mask;
-        }
-    }
+    state.registers[0xF] = draw_sprite(state, state.registers[instr.x()], state.registers[instr.y()],
+        state.index_register, instr.n());
 }
 
-void opcode_skip_kp(Instruction instr) {
-    log_info(std::format("SKIP_IF_KP"));
+void opcode_skip_kp(Chip8State& state, Instruction instr) {
+    log_info("SKIP_IF_KP");
 
-    if (keys_pressed[registers[instr.x]]) {
-        program_counter += 2;
+    if (state.keys_pressed[state.registers[instr.x()] & 0xF]) {
+        state.program_counter += 2;
     }
 }
 
-void opcode_skip_not_kp(Instruction instr) {
-    log_info(std::format("SKIP_IF_NOT_KP"));
+void opcode_skip_not_kp(Chip8State& state, Instruction instr) {
+    log_info("SKIP_IF_NOT_KP");
 
-    if (!keys_pressed[registers[instr.x]]) {
-        program_counter += 2;
+    if (!state.keys_pressed[state.registers[instr.x()] & 0xF]) {
+        state.program_counter += 2;
     }
 }
 
 // 0xF...
-void opcode_set_x_to_delay(Instruction instr) {
-    log_info(std::format("SET REG({:02X}) DELAY", instr.x));
+void opcode_set_x_to_delay(Chip8State& state, Instruction instr) {
+    log_info("SET REG({:02X}) DELAY", instr.x());
 
-    registers[instr.x] = delay_timer;
+    state.registers[instr.x()] = state.delay_timer;
 }
 
-void opcode_wait_keypress(Instruction instr) {
-    log_info(std::format("WAIT_KP"));
+void opcode_wait_keypress(Chip8State& state, Instruction instr) {
+    log_info("WAIT_KP");
 
     // Check for each key if they are pressed.
     bool any_key_pressed = false;
     uint8_t key_val;
     for (uint8_t i = 0; i < 16; i++) {
-        if (keys_released[i]) {
+        if (state.keys_released[i]) {
             any_key_pressed = true;
             key_val = i;
             break;
@@ -266,74 +280,74 @@ void opcode_wait_keypress(Instruction instr) {
     // If a key is pressed, store its value (lower value has higher priority and
     // continue execution)
     if (!any_key_pressed) {
-        program_counter -= 2;
+        state.program_counter -= 2;
     } else {
-        registers[instr.x] = key_val;
+        state.registers[instr.x()] = key_val;
     }
 }
 
-void opcode_set_delay_to_x(Instruction instr) {
-    log_info(std::format("SET DELAY REG({:02X})", instr.x));
+void opcode_set_delay_to_x(Chip8State& state, Instruction instr) {
+    log_info("SET DELAY REG({:02X})", instr.x());
 
-    delay_timer = registers[instr.x];
+    state.delay_timer = state.registers[instr.x()];
 }
 
-void opcode_set_sound_to_x(Instruction instr) {
-    log_info(std::format("SET SOUND REG({:02X})", instr.x));
+void opcode_set_sound_to_x(Chip8State& state, Instruction instr) {
+    log_info("SET SOUND REG({:02X})", instr.x());
 
-    sound_timer = registers[instr.x];
+    state.sound_timer = state.registers[instr.x()];
 }
 
-void opcode_add_x_to_index(Instruction instr) {
-    log_info(std::format("ADD INDEX REG({:02X})", instr.x));
+void opcode_add_x_to_index(Chip8State& state, Instruction instr) {
+    log_info("ADD INDEX REG({:02X})", instr.x());
 
-    int temp = index_register + registers[instr.x];
+    int temp = state.index_register + state.registers[instr.x()];
 
     if (temp > 0xFFF) {
-        registers[0xF] = 0b1;
+        state.registers[0xF] = 0b1;
     }
 
-    index_register += registers[instr.x];
+    state.index_register += state.registers[instr.x()];
 }
 
-void opcode_set_index_sprite(Instruction instr) {
-    log_info(std::format("SET_SPRITE REG({:02X})", instr.x));
+void opcode_set_index_sprite(Chip8State& state, Instruction instr) {
+    log_info("SET_SPRITE REG({:02X})", instr.x());
 
-    uint8_t hex_char = registers[instr.x] & 0x0F;
+    uint8_t hex_char = state.registers[instr.x()] & 0x0F;
 
-    index_register = 0x050 + (hex_char * 5);
+    state.index_register = 0x050 + (hex_char * 5);
 }
 
-void opcode_write_bcd(Instruction instr) {
-    log_info(std::format("WRITE_BCD"));
+void opcode_write_bcd(Chip8State& state, Instruction instr) {
+    log_info("WRITE_BCD");
 
-    int num = registers[instr.x];
+    int num = state.registers[instr.x()];
     uint8_t hundreths = num / 100;
     uint8_t tenths = (num - (100 * hundreths)) / 10;
     uint8_t ones = (num - (100 * hundreths + 10 * tenths));
 
-    memory[index_register] = hundreths;
-    memory[index_register + 1] = tenths;
-    memory[index_register + 2] = ones;
+    state.memory.write(state.index_register, hundreths);
+    state.memory.write(state.index_register + 1, tenths);
+    state.memory.write(state.index_register + 2, ones);
 
 }
 
-void opcode_write_regs(Instruction instr) {
-    log_info(std::format("WRITE_MEMORY"));
+void opcode_write_regs(Chip8State& state, Instruction instr) {
+    log_info("WRITE_MEMORY");
 
-    for (int i = 0; i <= instr.x; i++) {
-        memory[index_register] = registers[i];
+    for (int i = 0; i <= instr.x(); i++) {
+        state.memory.write(state.index_register, state.registers[i]);
 
-        index_register++;
+        state.index_register++;
     }
 }
 
-void opcode_read_regs(Instruction instr) {
-    log_info(std::format("READ_MEMORY"));
+void opcode_read_regs(Chip8State& state, Instruction instr) {
+    log_info("READ_MEMORY");
 
-    for (int i = 0; i <= instr.x; i++) {
-        registers[i] = memory[index_register];
+    for (int i = 0; i <= instr.x(); i++) {
+        state.registers[i] = state.memory[state.index_register];
 
-        index_register++;
+        state.index_register++;
     }
 }
\ No newline at end of file
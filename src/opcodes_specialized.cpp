@@ -0,0 +1,121 @@
+#include <array>
+#include <utility>
+
+#include "opcodes.h"
+#include "cpu.h"
+#include "logger.h"
+
+#if CHIP8_SPECIALIZED_ALU
+
+/**
+ * @brief Log an 8XYN instruction the way the generic handler does. Shared by
+ * all specialisations, formatting inline in each of them would multiply the
+ * code size.
+ */
+__attribute__((noinline, cold)) static void log_alu(int n, int x, int y) {
+    switch (n)
+    {
+    case 0x0: log_info("SET REG({:02X}) = REG({:02X})", x, y); break;
+    case 0x1: log_info("OR REG({:02X}) REG({:02X})", x, y); break;
+    case 0x2: log_info("AND REG({:02X}) REG({:02X})", x, y); break;
+    case 0x3: log_info("XOR REG({:02X}) REG({:02X})", x, y); break;
+    case 0x4: log_info("ADD REG({:02X}) REG({:02X})", x, y); break;
+    case 0x5: log_info("SUB REG({:02X}) REG({:02X})", x, y); break;
+    case 0x6: log_info("RSHIFT REG({:02X})", y); break;
+    case 0x7: log_info("SUB REG({:02X}) REG({:02X})", y, x); break;
+    case 0xE: log_info("LSHIFT REG({:02X})", y); break;
+    }
+}
+
+/**
+ * @brief The 8XYN handlers of opcodes.cpp with the opcode and both registers
+ * as template parameters, so register accesses compile to fixed offsets in
+ * the state and the operation needs no dispatch. Must behave exactly like the
+ * generic handlers, flag register ordering included.
+ */
+template <int N, int X, int Y>
+static void opcode_alu(Chip8State& state, Instruction instr) {
+    uint8_t* v = state.registers;
+
+    if (logging_enabled) {
+        log_alu(N, X, Y);
+    }
+
+    if constexpr (N == 0x0) {
+        v[X] = v[Y];
+    } else if constexpr (N == 0x1) {
+        v[X] = v[X] | v[Y];
+    } else if constexpr (N == 0x2) {
+        v[X] = v[X] & v[Y];
+    } else if constexpr (N == 0x3) {
+        v[X] = v[X] ^ v[Y];
+    } else if constexpr (N == 0x4) {
+        bool overflowed = v[X] + v[Y] > 0xFF;
+        v[X] += v[Y];
+        v[0xF] = overflowed;
+    } else if constexpr (N == 0x5) {
+        uint8_t flag = v[Y] <= v[X];
+        v[X] = v[X] - v[Y];
+        v[0xF] = flag;
+    } else if constexpr (N == 0x6) {
+        bool bit_out = (v[Y] & 0b1) == 0b1;
+        v[X] = v[Y] >> 1;
+        v[0xF] = bit_out;
+    } else if constexpr (N == 0x7) {
+        uint8_t flag = v[X] <= v[Y];
+        v[X] = v[Y] - v[X];
+        v[0xF] = flag;
+    } else if constexpr (N == 0xE) {
+        bool bit_out = (v[Y] & 0b10000000) == 0b10000000;
+        v[X] = v[Y] << 1;
+        v[0xF] = bit_out;
+    }
+}
+
+/**
+ * @brief The handler for table index NXY (12 bits), or nullptr for the N that
+ * are not 8XYN instructions.
+ */
+template <int INDEX>
+static constexpr OpcodeHandler alu_table_entry() {
+    constexpr int N = INDEX >> 8;
+    constexpr int X = (INDEX >> 4) & 0xF;
+    constexpr int Y = INDEX & 0xF;
+
+    if constexpr (N <= 0x7 || N == 0xE) {
+        return &opcode_alu<N, X, Y>;
+    } else {
+        return nullptr;
+    }
+}
+
+template <size_t... INDICES>
+static constexpr std::array<OpcodeHandler, sizeof...(INDICES)> make_alu_table(std::index_sequence<INDICES...>) {
+    return {alu_table_entry<INDICES>()...};
+}
+
+static constexpr std::array<OpcodeHandler, 16 * 16 * 16> ALU_TABLE = make_alu_table(std::make_index_sequence<16 * 16 * 16>());
+
+#endif
+
+/**
+ * @brief Get the handler specialised for an 8XYN instruction, to be used in
+ * place of execute().
+ *
+ * @param instr_bytes The raw instruction.
+ * @return OpcodeHandler The handler, or nullptr if the instruction is not
+ * 8XYN or the build does not have the specialised handlers.
+ */
+OpcodeHandler specialized_alu_handler(uint16_t instr_bytes) {
+#if CHIP8_SPECIALIZED_ALU
+    if ((instr_bytes & 0xF000) == 0x8000) {
+        int n = instr_bytes & 0xF;
+        int x = (instr_bytes >> 8) & 0xF;
+        int y = (instr_bytes >> 4) & 0xF;
+
+        return ALU_TABLE[n << 8 | x << 4 | y];
+    }
+#endif
+
+    return nullptr;
+}
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "phosphor.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHIP8_PHOSPHOR_AVX2 1
+#include <immintrin.h>
+#else
+#define CHIP8_PHOSPHOR_AVX2 0
+#endif
+
+
+/**
+ * @brief Lookup table that moves the 8 bits of a byte to the lowest bit of 8
+ * nibbles, the most significant bit (leftmost pixel) to the lowest nibble.
+ */
+static constexpr auto SPREAD_NIBBLES = [] {
+    std::array<uint32_t, 256> table = {};
+
+    for (int byte = 0; byte < 256; byte++) {
+        for (int bit = 0; bit < 8; bit++) {
+            if (byte & (0x80 >> bit)) {
+                table[byte] |= 1u << (bit * 4);
+            }
+        }
+    }
+
+    return table;
+}();
+
+#if CHIP8_PHOSPHOR_AVX2
+
+/**
+ * @brief Look up the colors of 8 pixels at once. Entries 0 to 7 of the
+ * palette are all the off color, so only the lit half needs a permute.
+ */
+__attribute__((target("avx2"))) static void expand_8_avx2(uint32_t indices, const uint32_t palette[16], uint32_t* out) {
+    const __m256i shifts = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+
+    __m256i index = _mm256_srlv_epi32(_mm256_set1_epi32(indices), shifts);
+    __m256i lit = _mm256_cmpeq_epi32(_mm256_and_si256(index, _mm256_set1_epi32(8)), _mm256_set1_epi32(8));
+
+    __m256i lit_colors = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*) (palette + 8)), index);
+    __m256i colors = _mm256_blendv_epi8(_mm256_set1_epi32(palette[0]), lit_colors, lit);
+
+    _mm256_storeu_si256((__m256i*) out, colors);
+}
+
+#endif
+
+
+/**
+ * @brief Add an emulated frame to the history of the filter.
+ *
+ * @param filter The filter to add to.
+ * @param rows The packed framebuffer of the frame.
+ */
+void phosphor_push(PhosphorFilter& filter, const uint64_t rows[32]) {
+    filter.newest = (filter.newest + 1) % PHOSPHOR_MAX_FRAMES;
+    std::memcpy(filter.history[filter.newest], rows, sizeof(filter.history[0]));
+}
+
+/**
+ * @brief Mix two 0xRRGGBB colors.
+ *
+ * @param weight Weight of color a, between 0 and 1.
+ */
+static uint32_t mix_colors(uint32_t a, uint32_t b, float weight) {
+    uint32_t result = 0;
+
+    for (int shift = 0; shift < 24; shift += 8) {
+        float channel_a = (a >> shift) & 0xFF;
+        float channel_b = (b >> shift) & 0xFF;
+
+        result |= (uint32_t) (channel_b + (channel_a - channel_b) * weight + 0.5f) << shift;
+    }
+
+    return result;
+}
+
+/**
+ * @brief Expand the filtered screen to a 64x32 array of 0xRRGGBB colors.
+ *
+ * Per row the age of the most recent frame that lit each pixel is computed as
+ * three bit planes with plain word operations, so 64 pixels are handled at
+ * once. Every pixel then only needs one lookup in a 16 entry palette, indexed
+ * by (lit << 3) | age, done 8 pixels at a time with AVX2 when available.
+ *
+ * @param filter The filter with the frame history.
+ * @param on_color Color of a pixel lit in the newest frame.
+ * @param off_color Color of a pixel that has been off for all frames.
+ * @param colors Output, 64 * 32 colors, row by row.
+ */
+void phosphor_expand(const PhosphorFilter& filter, uint32_t on_color, uint32_t off_color, uint32_t* colors) {
+#if CHIP8_PHOSPHOR_AVX2
+    static const bool use_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    int frames = std::clamp(filter.frames, 1, PHOSPHOR_MAX_FRAMES);
+
+    uint32_t palette[16];
+    float weight = 1.f;
+    for (int age = 0; age < 8; age++) {
+        palette[age] = off_color;
+        palette[8 + age] = mix_colors(on_color, off_color, weight);
+        weight *= filter.decay;
+    }
+
+    uint64_t lit[32] = {};
+    uint64_t age_bit0[32] = {};
+    uint64_t age_bit1[32] = {};
+    uint64_t age_bit2[32] = {};
+
+    // Newest frame first, so every pixel keeps the youngest age it was lit at.
+    for (int age = 0; age < frames; age++) {
+        const uint64_t* rows = filter.history[(filter.newest - age + PHOSPHOR_MAX_FRAMES) % PHOSPHOR_MAX_FRAMES];
+
+        uint64_t mask0 = (age & 1) ? ~0ull : 0;
+        uint64_t mask1 = (age & 2) ? ~0ull : 0;
+        uint64_t mask2 = (age & 4) ? ~0ull : 0;
+
+        for (int row = 0; row < 32; row++) {
+            uint64_t hit = rows[row] & ~lit[row];
+
+            lit[row] |= hit;
+            age_bit0[row] |= hit & mask0;
+            age_bit1[row] |= hit & mask1;
+            age_bit2[row] |= hit & mask2;
+        }
+    }
+
+    for (int row = 0; row < 32; row++) {
+        uint32_t* out = colors + row * 64;
+
+        for (int byte = 0; byte < 8; byte++) {
+            int shift = 56 - byte * 8;
+
+            // Palette index of 8 pixels, one per nibble, leftmost pixel lowest.
+            uint32_t indices = SPREAD_NIBBLES[(lit[row] >> shift) & 0xFF] << 3
+                | SPREAD_NIBBLES[(age_bit2[row] >> shift) & 0xFF] << 2
+                | SPREAD_NIBBLES[(age_bit1[row] >> shift) & 0xFF] << 1
+                | SPREAD_NIBBLES[(age_bit0[row] >> shift) & 0xFF];
+
+#if CHIP8_PHOSPHOR_AVX2
+            if (use_avx2) {
+                expand_8_avx2(indices, palette, out + byte * 8);
+                continue;
+            }
+#endif
+            for (int pixel = 0; pixel < 8; pixel++) {
+                out[byte * 8 + pixel] = palette[(indices >> (pixel * 4)) & 0xF];
+            }
+        }
+    }
+}
@@ -0,0 +1,194 @@
+#include "predecode.h"
+#include "cpu.h"
+#include "opcodes.h"
+#include "logger.h"
+#include "config.h"
+#include "audio.h"
+
+
+static uint16_t read_word(const Memory& memory, uint16_t address) {
+    return (memory[address] << 8) | memory[address + 1];
+}
+
+/**
+ * @brief Find the superinstruction that starts with the given words, if any.
+ */
+static Superinstruction match_superinstruction(const uint16_t raw[3]) {
+    // FX07; 3XNN; 1NNN with the same X
+    if ((raw[0] & 0xF0FF) == 0xF007 && (raw[1] & 0xF000) == 0x3000
+            && (raw[1] & 0x0F00) == (raw[0] & 0x0F00) && (raw[2] & 0xF000) == 0x1000) {
+        return SUPER_DELAY_WAIT;
+    }
+
+    // 6XNN; 6YNN; DXYN
+    if ((raw[0] & 0xF000) == 0x6000 && (raw[1] & 0xF000) == 0x6000 && (raw[2] & 0xF000) == 0xD000) {
+        return SUPER_LOAD_DRAW;
+    }
+
+    // 7XNN; 3XNN or 4XNN with the same X
+    if ((raw[0] & 0xF000) == 0x7000 && ((raw[1] & 0xF000) == 0x3000 || (raw[1] & 0xF000) == 0x4000)
+            && (raw[1] & 0x0F00) == (raw[0] & 0x0F00)) {
+        return SUPER_COUNTER;
+    }
+
+    return SUPER_NONE;
+}
+
+/**
+ * @brief Get the decoded instruction or superinstruction at an address,
+ * decoding it again if the memory there changed.
+ *
+ * @param memory The memory the instructions are in.
+ * @param address Address of the first instruction.
+ * @return const PredecodedEntry& The decoded entry, valid until the next
+ * lookup of the same address.
+ */
+const PredecodedEntry& PredecodeCache::lookup(const Memory& memory, uint16_t address) {
+    address &= ADDRESS_MASK;
+    PredecodedEntry& entry = m_entries[address];
+
+    bool valid = entry.length > 0;
+    for (int i = 0; valid && i < entry.length; i++) {
+        valid = entry.instr[i].raw == read_word(memory, address + i * 2);
+    }
+
+    if (valid) {
+        return entry;
+    }
+
+    uint16_t raw[3];
+    for (int i = 0; i < 3; i++) {
+        raw[i] = read_word(memory, address + i * 2);
+    }
+
+    entry.super = match_superinstruction(raw);
+    entry.length = entry.super == SUPER_NONE ? 1 : entry.super == SUPER_COUNTER ? 2 : 3;
+
+    for (int i = 0; i < entry.length; i++) {
+        entry.instr[i] = decode(raw[i]);
+    }
+
+    entry.handler = entry.super == SUPER_NONE ? specialized_alu_handler(raw[0]) : nullptr;
+
+    return entry;
+}
+
+/**
+ * @brief What cpu_execute_instruction() does around the execution of an
+ * instruction: move the PC past it before, and advance the timers after.
+ */
+static inline void begin_instruction(Chip8State& state, uint16_t raw) {
+    state.program_counter += 2;
+
+    log_info("PC={:04X}; OPCODE={:04X}", state.program_counter - 2, raw);
+}
+
+static inline void end_instruction(Chip8State& state, SoundRenderer* sound) {
+    update_clocks(state, 1000.f / (TIMER_FREQ * INSTR_PER_FRAME));
+
+    if (sound) {
+        sound->add_instruction(state.sound_timer > 0);
+    }
+}
+
+/**
+ * @brief Execute the next instruction, or a whole superinstruction if one
+ * starts at the PC and fits in the budget, without fetching or decoding.
+ * The result is exactly the same as executing the instructions one by one
+ * with cpu_execute_instruction(): the timers advance per instruction, and a
+ * jump or skip into the middle of a superinstruction simply lands on the
+ * entry of that address.
+ *
+ * @param state The machine to advance.
+ * @param cache The decoded instructions.
+ * @param budget Maximum amount of instructions to execute, at least 1.
+ * @param sound Optional, receives the audio of every executed instruction.
+ * @return int The amount of instructions executed, a faulted machine idles
+ * for one.
+ */
+int cpu_execute_predecoded(Chip8State& state, PredecodeCache& cache, int budget, SoundRenderer* sound) {
+    // A faulted machine executes nothing, only the timers keep running.
+    if (state.fault) {
+        end_instruction(state, sound);
+        return 1;
+    }
+
+    uint16_t start = state.program_counter;
+    const PredecodedEntry& entry = cache.lookup(state.memory, start);
+
+    if (entry.length > budget || entry.super == SUPER_NONE) {
+        begin_instruction(state, entry.instr[0].raw);
+
+        if (entry.handler) {
+            entry.handler(state, entry.instr[0]);
+        } else {
+            execute(state, entry.instr[0]);
+        }
+
+        end_instruction(state, sound);
+
+        return 1;
+    }
+
+    int executed = 0;
+
+    switch (entry.super)
+    {
+    case SUPER_DELAY_WAIT:
+        // Keep going around the loop while it jumps back to itself, the
+        // instructions don't write memory so the entry stays valid.
+        do {
+            begin_instruction(state, entry.instr[0].raw);
+            opcode_set_x_to_delay(state, entry.instr[0]);
+            end_instruction(state, sound);
+
+            begin_instruction(state, entry.instr[1].raw);
+            opcode_skip_val_eq(state, entry.instr[1]);
+            end_instruction(state, sound);
+
+            executed += 2;
+
+            // Skipped the jump, the wait is over.
+            if (state.program_counter != (uint16_t) (start + 4)) {
+                break;
+            }
+
+            begin_instruction(state, entry.instr[2].raw);
+            opcode_jump_address(state, entry.instr[2]);
+            end_instruction(state, sound);
+
+            executed++;
+        } while (state.program_counter == start && budget - executed >= 3);
+        break;
+    case SUPER_LOAD_DRAW:
+        begin_instruction(state, entry.instr[0].raw);
+        opcode_set_x(state, entry.instr[0]);
+        end_instruction(state, sound);
+
+        begin_instruction(state, entry.instr[1].raw);
+        opcode_set_x(state, entry.instr[1]);
+        end_instruction(state, sound);
+
+        begin_instruction(state, entry.instr[2].raw);
+        opcode_draw(state, entry.instr[2]);
+        end_instruction(state, sound);
+
+        executed = 3;
+        break;
+    case SUPER_COUNTER:
+        begin_instruction(state, entry.instr[0].raw);
+        opcode_add_x(state, entry.instr[0]);
+        end_instruction(state, sound);
+
+        begin_instruction(state, entry.instr[1].raw);
+        execute(state, entry.instr[1]);
+        end_instruction(state, sound);
+
+        executed = 2;
+        break;
+    default:
+        break;
+    }
+
+    return executed;
+}
@@ -0,0 +1,39 @@
+#include <algorithm>
+#include <cmath>
+
+#include "profiler.h"
+
+
+/**
+ * @brief Add a duration to the history of a stage, replacing the oldest one
+ * once the history is full.
+ *
+ * @param stage The stage that was measured.
+ * @param microseconds How long it took.
+ */
+void stage_add_sample(StageTimings& stage, float microseconds) {
+    stage.samples[stage.next] = microseconds;
+    stage.next = (stage.next + 1) % PROFILE_HISTORY;
+    stage.count = std::min(stage.count + 1, PROFILE_HISTORY);
+}
+
+/**
+ * @brief Get a percentile of the durations in the history of a stage.
+ *
+ * @param stage The stage to look at.
+ * @param percentile Between 0 and 100, e.g. 50 for the median.
+ * @return float The duration in microseconds, 0 if there are no samples.
+ */
+float stage_percentile(const StageTimings& stage, float percentile) {
+    if (stage.count == 0) {
+        return 0.f;
+    }
+
+    float sorted[PROFILE_HISTORY];
+    std::copy(stage.samples, stage.samples + stage.count, sorted);
+
+    int rank = std::clamp((int) std::ceil(percentile / 100.f * stage.count) - 1, 0, stage.count - 1);
+    std::nth_element(sorted, sorted + rank, sorted + stage.count);
+
+    return sorted[rank];
+}
@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <cstring>
+
+#include "rewind.h"
+#include "cpu.h"
+#include "debugger.h"
+
+
+/**
+ * @brief Record the machine before instructions are executed on it: its keys
+ * if they changed since the last batch, and a snapshot if the last one is
+ * `interval` instructions ago.
+ *
+ * @param state The machine, about to execute the next batch.
+ */
+void RewindHistory::begin_batch(const Chip8State& state) {
+    bool keys_changed = m_inputs.empty()
+        || std::memcmp(m_inputs.back().keys_pressed, state.keys_pressed, sizeof(state.keys_pressed)) != 0
+        || std::memcmp(m_inputs.back().keys_released, state.keys_released, sizeof(state.keys_released)) != 0;
+
+    if (keys_changed) {
+        InputChange input;
+        input.instruction = m_instruction;
+        std::memcpy(input.keys_pressed, state.keys_pressed, sizeof(input.keys_pressed));
+        std::memcpy(input.keys_released, state.keys_released, sizeof(input.keys_released));
+
+        m_inputs.push_back(input);
+    }
+
+    if (m_snapshots.empty() || m_instruction - m_snapshots.back().instruction >= m_interval) {
+        m_snapshots.push_back({m_instruction, state.fork()});
+
+        if (m_snapshots.size() > m_max_snapshots) {
+            m_snapshots.pop_front();
+
+            // Keys logged before the oldest snapshot are never replayed again.
+            while (m_inputs.size() > 1 && m_inputs[1].instruction <= m_snapshots.front().instruction) {
+                m_inputs.pop_front();
+            }
+        }
+    }
+}
+
+/**
+ * @brief Restore a snapshot and execute forward until `target` instructions
+ * have been executed since the start of the history, feeding the logged keys.
+ *
+ * @param snapshot Snapshot at or before the target.
+ * @param target The instruction to stop before.
+ * @param state Output, the machine at the target.
+ * @param breakpoints Optional, breakpoints to look for on the way.
+ * @param last_hit Output, the last instruction before the target that hit
+ * one of the breakpoints.
+ * @return bool Whether a breakpoint was hit.
+ */
+bool RewindHistory::replay(const Snapshot& snapshot, uint64_t target, Chip8State& state,
+        const Breakpoints* breakpoints, uint64_t* last_hit) const {
+    state = snapshot.state.fork();
+    bool found = false;
+
+    // Keys logged at the snapshot itself are already part of it, applying
+    // them again does no harm.
+    auto input = std::lower_bound(m_inputs.begin(), m_inputs.end(), snapshot.instruction,
+        [](const InputChange& change, uint64_t instruction) { return change.instruction < instruction; });
+
+    for (uint64_t i = snapshot.instruction; i < target; i++) {
+        for (; input != m_inputs.end() && input->instruction == i; input++) {
+            std::memcpy(state.keys_pressed, input->keys_pressed, sizeof(state.keys_pressed));
+            std::memcpy(state.keys_released, input->keys_released, sizeof(state.keys_released));
+        }
+
+        if (breakpoints && breakpoint_hit(*breakpoints, state) != BREAK_NONE) {
+            found = true;
+            *last_hit = i;
+        }
+
+        cpu_execute_instruction(state);
+    }
+
+    return found;
+}
+
+/**
+ * @brief Forget everything from an instruction on, the machine will take a
+ * different path from there. A snapshot at the instruction itself goes too,
+ * the keys may differ this time.
+ */
+void RewindHistory::truncate(uint64_t instruction) {
+    while (!m_snapshots.empty() && m_snapshots.back().instruction >= instruction) {
+        m_snapshots.pop_back();
+    }
+
+    // The next begin_batch() logs the keys at this point again.
+    while (!m_inputs.empty() && m_inputs.back().instruction >= instruction) {
+        m_inputs.pop_back();
+    }
+
+    m_instruction = instruction;
+}
+
+/**
+ * @brief Put the machine back to how it was `count` instructions ago.
+ *
+ * @param state The machine to rewind.
+ * @param count Amount of instructions to undo.
+ * @return bool False if the history does not go back that far, the machine
+ * is left untouched then.
+ */
+bool RewindHistory::step_back(Chip8State& state, uint64_t count) {
+    if (m_snapshots.empty() || count > m_instruction - m_snapshots.front().instruction) {
+        return false;
+    }
+
+    uint64_t target = m_instruction - count;
+
+    auto snapshot = std::upper_bound(m_snapshots.begin(), m_snapshots.end(), target,
+        [](uint64_t instruction, const Snapshot& snapshot) { return instruction < snapshot.instruction; });
+
+    replay(*(snapshot - 1), target, state);
+    truncate(target);
+
+    return true;
+}
+
+/**
+ * @brief Rewind the machine to the last time it was about to execute an
+ * instruction with a PC or opcode class breakpoint. The segments between
+ * snapshots are searched from the newest to the oldest.
+ *
+ * @param state The machine to rewind.
+ * @param breakpoints The breakpoints to look for.
+ * @return bool False if no breakpoint was hit within the history, the machine
+ * is left untouched then.
+ */
+bool RewindHistory::run_back(Chip8State& state, const Breakpoints& breakpoints) {
+    uint64_t end = m_instruction;
+
+    for (auto snapshot = m_snapshots.rbegin(); snapshot != m_snapshots.rend(); snapshot++) {
+        if (snapshot->instruction >= end) {
+            continue;
+        }
+
+        // Execute the segment and remember the last instruction with a hit.
+        Chip8State replayed;
+        uint64_t hit = 0;
+        bool found = replay(*snapshot, end, replayed, &breakpoints, &hit);
+
+        if (found) {
+            replay(*snapshot, hit, state);
+            truncate(hit);
+
+            return true;
+        }
+
+        end = snapshot->instruction;
+    }
+
+    return false;
+}
@@ -0,0 +1,316 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <format>
+#include <iterator>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#include "runner.h"
+#include "thread_pool.h"
+#include "chip8core.h"
+#include "config.h"
+#include "logger.h"
+
+
+/**
+ * @brief Read a whole binary file into a buffer.
+ *
+ * @param path Path of the file.
+ * @param data Receives the file contents.
+ * @return bool False if the file could not be opened.
+ */
+bool read_binary_file(const std::string& path, std::vector<uint8_t>& data) {
+    std::ifstream file(path, std::ios_base::binary);
+
+    if (!file) {
+        return false;
+    }
+
+    data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    return true;
+}
+
+/**
+ * @brief Parse a decimal number, nothing but digits. Used for the command
+ * line and the job list.
+ *
+ * @param text The text to parse.
+ * @param min Smallest accepted value.
+ * @param max Largest accepted value.
+ * @param value Receives the number.
+ * @return bool False if the text is not a number between min and max.
+ */
+bool parse_number(const char* text, uint64_t min, uint64_t max, uint64_t& value) {
+    // strtoull() would skip whitespace and accept a sign.
+    if (!std::isdigit((unsigned char) text[0])) {
+        return false;
+    }
+
+    char* end;
+    errno = 0;
+    unsigned long long parsed = std::strtoull(text, &end, 10);
+
+    if (*end != '\0' || errno == ERANGE || parsed < min || parsed > max) {
+        return false;
+    }
+
+    value = parsed;
+
+    return true;
+}
+
+/**
+ * @brief Parse a random seed, see parse_number().
+ *
+ * @param text The text to parse.
+ * @param seed Receives the seed.
+ * @return bool False if the text is not a number that fits in 32 bits.
+ */
+bool parse_seed(const char* text, uint32_t& seed) {
+    uint64_t value;
+
+    if (!parse_number(text, 0, UINT32_MAX, value)) {
+        return false;
+    }
+
+    seed = (uint32_t) value;
+
+    return true;
+}
+
+/**
+ * @brief Read a job list. Every non-empty line that does not start with '#'
+ * describes one job:
+ *
+ *     <rom_path> <frames> [seed] [movie_path|-] [quirks]
+ *
+ * Where quirks is a comma separated list of quirk names, e.g. "wrap". The
+ * frame count (at least 1) and seed are checked like on the command line.
+ *
+ * @param path Path of the job list.
+ * @return std::vector<RunnerJob> The parsed jobs.
+ */
+std::vector<RunnerJob> read_job_list(const std::string& path) {
+    std::ifstream file(path);
+    std::vector<RunnerJob> jobs;
+
+    if (!file) {
+        throw std::runtime_error(std::format("Could not read job list {}", path));
+    }
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+
+        std::istringstream fields(line);
+        RunnerJob job;
+
+        if (!(fields >> job.rom_path) || job.rom_path[0] == '#') {
+            continue;
+        }
+
+        std::string frames, seed, quirks, rest;
+
+        if (!(fields >> frames)) {
+            throw std::runtime_error(std::format("{}:{}: expected a frame count", path, line_number));
+        }
+
+        if (!parse_number(frames.c_str(), 1, UINT64_MAX, job.frames)) {
+            throw std::runtime_error(std::format("{}:{}: invalid frame count {}", path, line_number, frames));
+        }
+
+        if (fields >> seed && !parse_seed(seed.c_str(), job.seed)) {
+            throw std::runtime_error(std::format("{}:{}: invalid seed {}", path, line_number, seed));
+        }
+
+        if (fields >> job.movie_path >> quirks >> rest) {
+            throw std::runtime_error(std::format("{}:{}: unexpected {}", path, line_number, rest));
+        }
+
+        if (job.movie_path == "-") {
+            job.movie_path.clear();
+        }
+
+        std::istringstream quirk_names(quirks);
+        std::string quirk;
+        while (std::getline(quirk_names, quirk, ',')) {
+            if (quirk == "wrap") {
+                job.quirks.wrap_sprites = true;
+            } else {
+                throw std::runtime_error(std::format("{}:{}: unknown quirk {}", path, line_number, quirk));
+            }
+        }
+
+        jobs.push_back(job);
+    }
+
+    return jobs;
+}
+
+/**
+ * @brief Read an input movie. Every line holds a frame number and a
+ * hexadecimal key mask that is held from that frame on, e.g. "120 0010"
+ * holds key 4 from frame 120.
+ *
+ * @param path Path of the movie.
+ * @return std::vector<MovieEntry> The movie entries, sorted by frame.
+ */
+std::vector<MovieEntry> read_movie(const std::string& path) {
+    std::ifstream file(path);
+    std::vector<MovieEntry> movie;
+
+    if (!file) {
+        throw std::runtime_error(std::format("Could not read input movie {}", path));
+    }
+
+    MovieEntry entry;
+    while (file >> std::dec >> entry.frame >> std::hex >> entry.key_mask) {
+        movie.push_back(entry);
+    }
+
+    std::stable_sort(movie.begin(), movie.end(),
+        [](const MovieEntry& a, const MovieEntry& b) { return a.frame < b.frame; });
+
+    return movie;
+}
+
+/**
+ * @brief Run a single job on its own emulator instance.
+ *
+ * @param job The job to run.
+ * @param rom The ROM image of the job.
+ * @param movie The input movie of the job, may be empty.
+ * @return RunnerResult The final screen hash, cycle count and wall time.
+ */
+RunnerResult run_job(const RunnerJob& job, const std::vector<uint8_t>& rom, const std::vector<MovieEntry>& movie) {
+    RunnerResult result;
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    Chip8 chip8(job.seed, job.quirks);
+
+    if (!chip8.load_rom(rom.data(), rom.size())) {
+        result.error = "ROM does not fit in memory";
+        return result;
+    }
+
+    size_t movie_pos = 0;
+
+    for (uint64_t frame = 0; frame < job.frames; frame++) {
+        while (movie_pos < movie.size() && movie[movie_pos].frame <= frame) {
+            chip8.set_keys(movie[movie_pos].key_mask);
+            movie_pos++;
+        }
+
+        chip8.run_frames();
+        result.cycles_executed += INSTR_PER_FRAME;
+
+        if (chip8.fault()) {
+            result.error = std::format("{} at {:03X} in frame {}", cpu_fault_name(chip8.fault()), cpu_fault_address(chip8.state()), frame);
+            break;
+        }
+    }
+
+    result.ok = !chip8.fault();
+    result.framebuffer_hash = chip8.framebuffer_hash();
+
+    auto end_time = std::chrono::steady_clock::now();
+    result.wall_time_ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+
+    return result;
+}
+
+/**
+ * @brief Run all jobs in parallel on a work-stealing thread pool. ROMs and
+ * movies shared between jobs are only read once.
+ *
+ * @param jobs The jobs to run.
+ * @param thread_count Amount of worker threads, 0 uses all cores.
+ * @return std::vector<RunnerResult> One result per job, in the order of jobs.
+ */
+std::vector<RunnerResult> run_jobs(const std::vector<RunnerJob>& jobs, int thread_count) {
+    std::vector<RunnerResult> results(jobs.size());
+
+    // Load all inputs up front, so the workers only share read-only data.
+    std::map<std::string, std::vector<uint8_t>> roms;
+    std::map<std::string, std::vector<MovieEntry>> movies;
+    std::vector<bool> loaded(jobs.size(), true);
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const RunnerJob& job = jobs[i];
+
+        if (!roms.count(job.rom_path) && !read_binary_file(job.rom_path, roms[job.rom_path])) {
+            roms.erase(job.rom_path);
+        }
+
+        if (!roms.count(job.rom_path)) {
+            results[i].error = std::format("Could not read ROM {}", job.rom_path);
+            loaded[i] = false;
+            continue;
+        }
+
+        try {
+            if (!movies.count(job.movie_path)) {
+                movies[job.movie_path] = job.movie_path.empty() ? std::vector<MovieEntry>() : read_movie(job.movie_path);
+            }
+        } catch (const std::exception& e) {
+            results[i].error = e.what();
+            loaded[i] = false;
+        }
+    }
+
+    ThreadPool pool(thread_count);
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (!loaded[i]) {
+            continue;
+        }
+
+        const std::vector<uint8_t>& rom = roms.at(jobs[i].rom_path);
+        const std::vector<MovieEntry>& movie = movies.at(jobs[i].movie_path);
+
+        pool.submit([&results, &jobs, &rom, &movie, i] {
+            results[i] = run_job(jobs[i], rom, movie);
+        });
+    }
+
+    pool.wait();
+
+    return results;
+}
+
+/**
+ * @brief Print one line per job with its result, followed by a summary.
+ */
+void print_job_results(const std::vector<RunnerJob>& jobs, const std::vector<RunnerResult>& results) {
+    uint64_t total_cycles = 0;
+    double total_time_ms = 0;
+    int failed = 0;
+
+    std::cout << "job\trom\tframes\tseed\tquirks\thash\tcycles\twall_ms\tstatus" << std::endl;
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const RunnerResult& result = results[i];
+
+        std::cout << std::format("{}\t{}\t{}\t{}\t{}\t{:016X}\t{}\t{:.3f}\t{}",
+            i, jobs[i].rom_path, jobs[i].frames, jobs[i].seed, jobs[i].quirks.wrap_sprites ? "wrap" : "-",
+            result.framebuffer_hash, result.cycles_executed, result.wall_time_ms,
+            result.ok ? "ok" : result.error) << std::endl;
+
+        total_cycles += result.cycles_executed;
+        total_time_ms += result.wall_time_ms;
+        failed += !result.ok;
+    }
+
+    std::cout << std::format("# {} jobs, {} failed, {} cycles, {:.3f} ms cpu time",
+        jobs.size(), failed, total_cycles, total_time_ms) << std::endl;
+}
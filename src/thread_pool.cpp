@@ -0,0 +1,139 @@
+#include <algorithm>
+
+#include "thread_pool.h"
+
+
+/**
+ * @brief Start the worker threads.
+ *
+ * @param thread_count Amount of workers, 0 uses one per hardware thread.
+ */
+ThreadPool::ThreadPool(int thread_count) {
+    if (thread_count <= 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (int i = 0; i < thread_count; i++) {
+        m_queues.push_back(std::make_unique<WorkerQueue>());
+    }
+
+    for (int i = 0; i < thread_count; i++) {
+        m_workers.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+/**
+ * @brief Finish all outstanding tasks, then stop and join the workers.
+ */
+ThreadPool::~ThreadPool() {
+    wait();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_work_available.notify_all();
+
+    for (std::thread& worker : m_workers) {
+        worker.join();
+    }
+}
+
+/**
+ * @brief Queue a task. Tasks are spread round-robin over the worker queues,
+ * idle workers steal them from there.
+ *
+ * @param task The task to run on one of the workers.
+ */
+void ThreadPool::submit(std::function<void()> task) {
+    unsigned queue_index = m_next_queue++ % m_queues.size();
+
+    m_unfinished++;
+
+    {
+        std::lock_guard<std::mutex> lock(m_queues[queue_index]->mutex);
+        m_queues[queue_index]->tasks.push_back(std::move(task));
+    }
+
+    {
+        // Taking the lock prevents a worker from missing the notification
+        // between checking m_queued and going to sleep.
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queued++;
+    }
+    m_work_available.notify_one();
+}
+
+/**
+ * @brief Block until every submitted task has finished.
+ */
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_all_done.wait(lock, [this] { return m_unfinished == 0; });
+}
+
+/**
+ * @brief Take a task for a worker: first from the back of its own queue, then
+ * from the front of the other queues.
+ *
+ * @param worker_index The worker looking for work.
+ * @param task Receives the task if one was found.
+ * @return bool Whether a task was found.
+ */
+bool ThreadPool::try_pop(int worker_index, std::function<void()>& task) {
+    WorkerQueue& own = *m_queues[worker_index];
+
+    {
+        std::lock_guard<std::mutex> lock(own.mutex);
+
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            m_queued--;
+
+            return true;
+        }
+    }
+
+    int queue_count = (int) m_queues.size();
+    for (int offset = 1; offset < queue_count; offset++) {
+        WorkerQueue& victim = *m_queues[(worker_index + offset) % queue_count];
+
+        std::lock_guard<std::mutex> lock(victim.mutex);
+
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            m_queued--;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::worker_loop(int worker_index) {
+    std::function<void()> task;
+
+    while (true) {
+        if (try_pop(worker_index, task)) {
+            task();
+            task = nullptr;
+
+            if (--m_unfinished == 0) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_all_done.notify_all();
+            }
+
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_work_available.wait(lock, [this] { return m_stopping || m_queued > 0; });
+
+        if (m_stopping && m_queued == 0) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,163 @@
+#include <cstring>
+
+#include "video_recorder.h"
+
+
+VideoRecorder::~VideoRecorder() {
+    close();
+}
+
+/**
+ * @brief Create the output file and start the writer thread.
+ *
+ * @param path Path of the file, the extension selects the format.
+ * @return bool False if the file could not be created.
+ */
+bool VideoRecorder::open(const std::string& path) {
+    m_file.open(path, std::ios_base::binary | std::ios_base::trunc);
+
+    if (!m_file) {
+        return false;
+    }
+
+    m_y4m = path.size() >= 4 && path.compare(path.size() - 4, 4, ".y4m") == 0;
+
+    if (m_y4m) {
+        m_file << "YUV4MPEG2 W64 H32 F60:1 Ip A1:1 Cmono\n";
+    } else {
+        m_file << "CHIP8VIDEO 64 32 60\n";
+    }
+
+    m_has_frame = false;
+    m_repeat_count = 0;
+    m_stopping = false;
+    m_writer = std::thread(&VideoRecorder::writer_loop, this);
+
+    return true;
+}
+
+/**
+ * @brief Record the screen of one emulated frame. Cheap when the screen did
+ * not change: only a compare and a counter.
+ *
+ * @param pixel_buffer The screen, one bit per pixel as in Chip8State.
+ */
+void VideoRecorder::add_frame(const uint64_t pixel_buffer[32]) {
+    if (!is_open()) {
+        return;
+    }
+
+    if (m_has_frame && std::memcmp(pixel_buffer, m_last_rows, sizeof(m_last_rows)) == 0) {
+        m_repeat_count++;
+        return;
+    }
+
+    Record record;
+    record.repeat_count = m_repeat_count;
+    std::memcpy(record.rows, pixel_buffer, sizeof(record.rows));
+
+    std::memcpy(m_last_rows, pixel_buffer, sizeof(m_last_rows));
+    m_has_frame = true;
+    m_repeat_count = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(record);
+    }
+    m_queue_changed.notify_one();
+}
+
+/**
+ * @brief Write the remaining frames, stop the writer thread and close the
+ * file.
+ */
+void VideoRecorder::close() {
+    if (!is_open()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_queue_changed.notify_one();
+
+    m_writer.join();
+
+    // Repeats of the last frame that were never followed by a new one.
+    write_repeats(m_repeat_count);
+    m_repeat_count = 0;
+
+    m_file.close();
+}
+
+void VideoRecorder::writer_loop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true) {
+        m_queue_changed.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+
+        if (m_queue.empty() && m_stopping) {
+            return;
+        }
+
+        Record record = m_queue.front();
+        m_queue.pop_front();
+
+        // Don't hold up the emulation thread while writing.
+        lock.unlock();
+        write_record(record);
+        lock.lock();
+    }
+}
+
+/**
+ * @brief Write the repeats of the previous frame.
+ */
+void VideoRecorder::write_repeats(uint32_t repeat_count) {
+    if (repeat_count == 0) {
+        return;
+    }
+
+    if (m_y4m) {
+        // Y4M has a fixed frame rate, the picture has to be written again.
+        for (uint32_t i = 0; i < repeat_count; i++) {
+            m_file << "FRAME\n";
+            m_file.write((const char*) m_last_luma, sizeof(m_last_luma));
+        }
+    } else {
+        m_file.put('R');
+        for (int i = 0; i < 4; i++) {
+            m_file.put((char) ((repeat_count >> (8 * i)) & 0xFF));
+        }
+    }
+}
+
+/**
+ * @brief Write the repeats preceding a frame, then the frame itself.
+ */
+void VideoRecorder::write_record(const Record& record) {
+    write_repeats(record.repeat_count);
+
+    if (m_y4m) {
+        for (int y = 0; y < 32; y++) {
+            for (int x = 0; x < 64; x++) {
+                m_last_luma[y * 64 + x] = ((record.rows[y] >> (63 - x)) & 0b1) ? 255 : 0;
+            }
+        }
+
+        m_file << "FRAME\n";
+        m_file.write((const char*) m_last_luma, sizeof(m_last_luma));
+    } else {
+        uint8_t packed[32 * 8];
+
+        for (int y = 0; y < 32; y++) {
+            for (int byte = 0; byte < 8; byte++) {
+                packed[y * 8 + byte] = (record.rows[y] >> (56 - 8 * byte)) & 0xFF;
+            }
+        }
+
+        m_file.put('F');
+        m_file.write((const char*) packed, sizeof(packed));
+    }
+}
@@ -0,0 +1,121 @@
+#include <algorithm>
+
+#include "wav_writer.h"
+
+
+/**
+ * @brief Write a value to a stream as little endian, as WAV requires.
+ */
+static void write_le(std::ofstream& file, uint32_t val, int byte_count) {
+    for (int i = 0; i < byte_count; i++) {
+        file.put((char) ((val >> (8 * i)) & 0xFF));
+    }
+}
+
+WavWriter::~WavWriter() {
+    close();
+}
+
+/**
+ * @brief Create the output file.
+ *
+ * @param path Path of the file, a ".raw" extension writes headerless PCM.
+ * @param sample_rate Sample rate of the audio.
+ * @return bool False if the file could not be created.
+ */
+bool WavWriter::open(const std::string& path, int sample_rate) {
+    m_file.open(path, std::ios_base::binary | std::ios_base::trunc);
+
+    if (!m_file) {
+        return false;
+    }
+
+    m_raw = path.size() >= 4 && path.compare(path.size() - 4, 4, ".raw") == 0;
+    m_sample_rate = sample_rate;
+    m_sample_count = 0;
+    m_chunk.reserve(WAV_CHUNK_SAMPLES);
+
+    // Reserve room for the header, the sizes are only known when closing.
+    if (!m_raw) {
+        write_header();
+    }
+
+    return true;
+}
+
+/**
+ * @brief Write the 44 byte RIFF/WAVE header for 16bit mono PCM.
+ */
+void WavWriter::write_header() {
+    uint32_t data_size = (uint32_t) std::min<uint64_t>(m_sample_count * sizeof(int16_t), 0xFFFFFFFF - 36);
+
+    m_file.write("RIFF", 4);
+    write_le(m_file, 36 + data_size, 4);
+    m_file.write("WAVE", 4);
+
+    m_file.write("fmt ", 4);
+    write_le(m_file, 16, 4);                            // Size of the fmt chunk
+    write_le(m_file, 1, 2);                             // PCM
+    write_le(m_file, 1, 2);                             // Mono
+    write_le(m_file, m_sample_rate, 4);
+    write_le(m_file, m_sample_rate * sizeof(int16_t), 4);  // Byte rate
+    write_le(m_file, sizeof(int16_t), 2);               // Block align
+    write_le(m_file, 16, 2);                            // Bits per sample
+
+    m_file.write("data", 4);
+    write_le(m_file, data_size, 4);
+}
+
+/**
+ * @brief Add samples to the file.
+ *
+ * @param samples The samples to write.
+ * @param sample_count Amount of samples.
+ */
+void WavWriter::write(const int16_t* samples, size_t sample_count) {
+    if (!m_file.is_open()) {
+        return;
+    }
+
+    while (sample_count > 0) {
+        size_t count = std::min(sample_count, WAV_CHUNK_SAMPLES - m_chunk.size());
+
+        m_chunk.insert(m_chunk.end(), samples, samples + count);
+        samples += count;
+        sample_count -= count;
+
+        if (m_chunk.size() == WAV_CHUNK_SAMPLES) {
+            flush();
+        }
+    }
+}
+
+/**
+ * @brief Write the collected chunk to disk.
+ */
+void WavWriter::flush() {
+    // Samples are written in host order, which matches the little endian
+    // AUDIO_S16SYS format on every platform we run on.
+    m_file.write((const char*) m_chunk.data(), m_chunk.size() * sizeof(int16_t));
+
+    m_sample_count += m_chunk.size();
+    m_chunk.clear();
+}
+
+/**
+ * @brief Write the remaining samples, fill in the header and close the file.
+ */
+void WavWriter::close() {
+    if (!m_file.is_open()) {
+        return;
+    }
+
+    flush();
+
+    if (!m_raw) {
+        m_file.seekp(0);
+        write_header();
+    }
+
+    m_file.close();
+}
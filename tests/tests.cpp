@@ -0,0 +1,509 @@
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "chip8core.h"
+#include "config.h"
+#include "batch.h"
+#include "rewind.h"
+#include "runner.h"
+#include "wav_writer.h"
+#include "video_recorder.h"
+
+
+// Failed checks of the test that is running.
+static int g_failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static bool check(bool condition, const char* text, const char* file, int line) {
+    if (!condition) {
+        std::cerr << std::format("{}:{}: check failed: {}", file, line, text) << std::endl;
+        g_failures++;
+    }
+
+    return condition;
+}
+
+/**
+ * @brief Compare everything of two machines that affects how they continue.
+ */
+static bool states_equal(const Chip8State& a, const Chip8State& b) {
+    if (std::memcmp(a.keys_pressed, b.keys_pressed, sizeof(a.keys_pressed)) != 0 ||
+        std::memcmp(a.keys_released, b.keys_released, sizeof(a.keys_released)) != 0 ||
+        std::memcmp(a.pixel_buffer, b.pixel_buffer, sizeof(a.pixel_buffer)) != 0 ||
+        std::memcmp(a.registers, b.registers, sizeof(a.registers)) != 0 ||
+        std::memcmp(a.stack, b.stack, sizeof(a.stack)) != 0 ||
+        a.index_register != b.index_register ||
+        a.program_counter != b.program_counter ||
+        a.stack_pointer != b.stack_pointer ||
+        a.delay_timer != b.delay_timer ||
+        a.sound_timer != b.sound_timer ||
+        a.timer_accum != b.timer_accum ||
+        a.rng_state != b.rng_state ||
+        a.fault != b.fault) {
+        return false;
+    }
+
+    for (int address = 0; address < MEMORY_SIZE; address++) {
+        if (a.memory[address] != b.memory[address]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief A random ROM that mostly consists of ALU instructions, skips, key
+ * checks and jumps within itself, so it runs for a while instead of jumping
+ * into empty memory. Stores and calls overwrite its own code and overflow
+ * the stack now and then.
+ */
+static std::vector<uint8_t> random_rom(std::mt19937& rng) {
+    const uint8_t alu_ops[] = {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE};
+
+    std::vector<uint8_t> rom(64 + rng() % 300);
+
+    for (uint8_t& byte : rom) {
+        byte = (uint8_t) rng();
+    }
+
+    for (size_t i = 0; i + 1 < rom.size(); i += 2) {
+        int kind = rng() % 10;
+
+        if (kind < 3) {
+            rom[i] = 0x80 | rng() % 16;
+            rom[i + 1] = (rng() % 16) << 4 | alu_ops[rng() % 9];
+        } else if (kind < 5) {
+            rom[i] = (0x3 + rng() % 4) << 4 | rng() % 16;
+        } else if (kind == 5) {
+            uint16_t target = 0x200 + (rng() % (rom.size() / 2)) * 2;
+            rom[i] = 0x10 | target >> 8;
+            rom[i + 1] = target & 0xFF;
+        } else if (kind == 6) {
+            rom[i] = 0xE0 | rng() % 16;
+            rom[i + 1] = rng() % 2 ? 0x9E : 0xA1;
+        }
+    }
+
+    return rom;
+}
+
+/**
+ * @brief Keys held by a test machine, a different pattern per instance.
+ */
+static uint16_t test_keys(int instance, int frame) {
+    return (uint16_t) (1 << ((frame / 4 + instance) % 16));
+}
+
+/**
+ * @brief cpu_execute_frame() runs predecoded instructions and
+ * superinstructions, it has to end up exactly where executing one
+ * instruction at a time does.
+ */
+static void test_predecode(const std::vector<uint8_t>& training_rom) {
+    std::mt19937 rng(1);
+
+    for (int rom_index = 0; rom_index < 200; rom_index++) {
+        std::vector<uint8_t> rom = rom_index == 0 ? training_rom : random_rom(rng);
+        int frame_count = rom_index == 0 ? 600 : 120;
+
+        Chip8State predecoded;
+        Chip8State single;
+        cpu_reset(predecoded, rom_index);
+        cpu_reset(single, rom_index);
+        cpu_load_rom(predecoded, rom.data(), rom.size());
+        cpu_load_rom(single, rom.data(), rom.size());
+
+        for (int frame = 0; frame < frame_count; frame++) {
+            cpu_set_keys(predecoded, test_keys(0, frame));
+            cpu_set_keys(single, test_keys(0, frame));
+
+            cpu_execute_frame(predecoded);
+
+            for (int i = 0; i < INSTR_PER_FRAME; i++) {
+                cpu_execute_instruction(single);
+            }
+            std::memset(single.keys_released, 0, sizeof(single.keys_released));
+
+            if (!CHECK(states_equal(predecoded, single))) {
+                std::cerr << std::format("ROM {} differs in frame {}", rom_index, frame) << std::endl;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Every lane of the batch engine has to end up like a scalar machine
+ * with the same seed and keys.
+ */
+static void test_batch(const std::vector<uint8_t>& training_rom) {
+    std::mt19937 rng(2);
+
+    for (int rom_index = 0; rom_index < 100; rom_index++) {
+        std::vector<uint8_t> rom = rom_index == 0 ? training_rom : random_rom(rng);
+        int lane_count = rom_index == 0 ? 70 : 1 + rng() % 70;
+        int frame_count = rom_index == 0 ? 300 : 60;
+        uint32_t seed = 1 + rng() % 1000;
+
+        std::vector<Chip8State> states(lane_count);
+        for (int lane = 0; lane < lane_count; lane++) {
+            cpu_reset(states[lane], seed + lane);
+            cpu_load_rom(states[lane], rom.data(), rom.size());
+        }
+
+        Chip8Batch batch(lane_count, rom.data(), rom.size(), seed);
+
+        for (int frame = 0; frame < frame_count; frame++) {
+            for (int lane = 0; lane < lane_count; lane++) {
+                cpu_set_keys(states[lane], test_keys(lane, frame));
+                cpu_execute_frame(states[lane]);
+
+                batch.set_keys(lane, test_keys(lane, frame));
+            }
+
+            batch.run_frame();
+        }
+
+        for (int lane = 0; lane < lane_count; lane++) {
+            if (!CHECK(states_equal(batch.get_lane(lane), states[lane]))) {
+                std::cerr << std::format("ROM {} lane {} differs", rom_index, lane) << std::endl;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Rewinding has to restore the machine exactly as it was, including
+ * the keys that were held at that point.
+ */
+static void test_rewind(const std::vector<uint8_t>& rom) {
+    const int instruction_count = 3000;
+
+    Chip8State state;
+    cpu_reset(state, 1);
+    cpu_load_rom(state, rom.data(), rom.size());
+
+    RewindHistory history(50, 1000);
+    std::vector<Chip8State> past;
+
+    for (int i = 0; i < instruction_count; i++) {
+        if (i % 100 == 0) {
+            cpu_set_keys(state, test_keys(0, i / 25));
+        }
+
+        past.push_back(state.fork());
+
+        history.begin_batch(state);
+        cpu_execute_instruction(state);
+        history.executed(1);
+    }
+
+    CHECK(history.step_back(state, 1));
+    CHECK(history.position() == instruction_count - 1);
+    CHECK(states_equal(state, past[instruction_count - 1]));
+
+    CHECK(history.step_back(state, 737));
+    CHECK(history.position() == instruction_count - 738);
+    CHECK(states_equal(state, past[instruction_count - 738]));
+
+    CHECK(!history.step_back(state, instruction_count));
+    CHECK(states_equal(state, past[instruction_count - 738]));
+
+    // Back to the last time the PC was at an address seen shortly before.
+    uint64_t position = history.position();
+    uint16_t address = past[position - 10].program_counter;
+
+    uint64_t last_hit = position - 10;
+    for (uint64_t i = last_hit; i < position; i++) {
+        if (past[i].program_counter == address) {
+            last_hit = i;
+        }
+    }
+
+    Breakpoints breakpoints;
+    breakpoint_set(breakpoints, address, true);
+
+    CHECK(history.run_back(state, breakpoints));
+    CHECK(history.position() == last_hit);
+    CHECK(states_equal(state, past[last_hit]));
+
+    // An address that was never executed is not found.
+    Breakpoints never_hit;
+    breakpoint_set(never_hit, 0x000, true);
+
+    CHECK(!history.run_back(state, never_hit));
+    CHECK(history.position() == last_hit);
+}
+
+/**
+ * @brief The framebuffer hash of a long run of the training ROM must not
+ * change, it is what --hash-out and the job runner report.
+ */
+static void test_hash(const std::vector<uint8_t>& rom) {
+    Chip8 chip8(1);
+    chip8.load_rom(rom.data(), rom.size());
+    chip8.run_frames(36000);
+
+    CHECK(chip8.framebuffer_hash() == 0x3A6803FB576ECC6D);
+
+    Quirks wrap;
+    wrap.wrap_sprites = true;
+
+    Chip8 wrapping(2, wrap);
+    wrapping.load_rom(rom.data(), rom.size());
+    wrapping.run_frames(36000);
+
+    CHECK(wrapping.framebuffer_hash() == 0x035B0CD88771A85B);
+}
+
+/**
+ * @brief Read and delete a file the test wrote.
+ */
+static std::vector<uint8_t> read_file(const std::string& path) {
+    std::vector<uint8_t> data;
+
+    CHECK(read_binary_file(path, data));
+    std::remove(path.c_str());
+
+    return data;
+}
+
+static uint32_t read_le(const std::vector<uint8_t>& data, size_t offset, int byte_count) {
+    uint32_t val = 0;
+
+    for (int i = 0; i < byte_count; i++) {
+        val |= (uint32_t) data[offset + i] << (8 * i);
+    }
+
+    return val;
+}
+
+/**
+ * @brief A WAV file holds the header with the final sizes and every sample,
+ * also over several chunks. A .raw file only the samples.
+ */
+static void test_wav(const std::vector<uint8_t>&) {
+    std::vector<int16_t> samples(WAV_CHUNK_SAMPLES + 1000);
+    for (size_t i = 0; i < samples.size(); i++) {
+        samples[i] = (int16_t) (i * 7);
+    }
+
+    for (std::string path : {"test_audio.wav", "test_audio.raw"}) {
+        WavWriter writer;
+        CHECK(writer.open(path, 44100));
+
+        // In uneven pieces, so a chunk fills up in the middle of one.
+        writer.write(samples.data(), 1000);
+        writer.write(samples.data() + 1000, samples.size() - 1000);
+        writer.close();
+
+        std::vector<uint8_t> data = read_file(path);
+        size_t data_size = samples.size() * sizeof(int16_t);
+        size_t header_size = path.ends_with(".wav") ? 44 : 0;
+
+        if (!CHECK(data.size() == header_size + data_size)) {
+            continue;
+        }
+
+        if (header_size) {
+            CHECK(std::memcmp(data.data(), "RIFF", 4) == 0);
+            CHECK(read_le(data, 4, 4) == 36 + data_size);
+            CHECK(std::memcmp(data.data() + 8, "WAVEfmt ", 8) == 0);
+            CHECK(read_le(data, 22, 2) == 1);
+            CHECK(read_le(data, 24, 4) == 44100);
+            CHECK(read_le(data, 34, 2) == 16);
+            CHECK(std::memcmp(data.data() + 36, "data", 4) == 0);
+            CHECK(read_le(data, 40, 4) == data_size);
+        }
+
+        bool samples_match = true;
+        for (size_t i = 0; i < samples.size(); i++) {
+            samples_match &= (int16_t) read_le(data, header_size + i * 2, 2) == samples[i];
+        }
+        CHECK(samples_match);
+    }
+}
+
+/**
+ * @brief Repeated frames are written out again in Y4M and as a repeat count
+ * in the packed format.
+ */
+static void test_video(const std::vector<uint8_t>&) {
+    uint64_t first[32] = {};
+    uint64_t second[32] = {};
+    first[0] = 1ull << 63;
+    second[31] = 1;
+
+    const uint64_t* frames[] = {first, first, second, second, second};
+
+    for (std::string path : {"test_video.y4m", "test_video.c8v"}) {
+        VideoRecorder recorder;
+        CHECK(recorder.open(path));
+
+        for (const uint64_t* frame : frames) {
+            recorder.add_frame(frame);
+        }
+        recorder.close();
+
+        std::vector<uint8_t> data = read_file(path);
+        std::string text(data.begin(), data.end());
+
+        if (path.ends_with(".y4m")) {
+            std::string header = "YUV4MPEG2 W64 H32 F60:1 Ip A1:1 Cmono\n";
+            size_t frame_size = 6 + 64 * 32;
+
+            if (!CHECK(data.size() == header.size() + 5 * frame_size) || !CHECK(text.starts_with(header))) {
+                continue;
+            }
+
+            for (int i = 0; i < 5; i++) {
+                size_t offset = header.size() + i * frame_size;
+                const uint8_t* luma = data.data() + offset + 6;
+                bool is_first = i < 2;
+
+                CHECK(text.compare(offset, 6, "FRAME\n") == 0);
+                CHECK(luma[0] == (is_first ? 255 : 0));
+                CHECK(luma[64 * 32 - 1] == (is_first ? 0 : 255));
+                CHECK(luma[1] == 0);
+            }
+        } else {
+            std::string header = "CHIP8VIDEO 64 32 60\n";
+
+            // F first, R 1, F second, R 2
+            if (!CHECK(data.size() == header.size() + 2 * (1 + 256) + 2 * (1 + 4)) || !CHECK(text.starts_with(header))) {
+                continue;
+            }
+
+            size_t offset = header.size();
+            CHECK(data[offset] == 'F' && data[offset + 1] == 0x80);
+            offset += 1 + 256;
+            CHECK(data[offset] == 'R' && read_le(data, offset + 1, 4) == 1);
+            offset += 1 + 4;
+            CHECK(data[offset] == 'F' && data[offset + 256] == 0x01);
+            offset += 1 + 256;
+            CHECK(data[offset] == 'R' && read_le(data, offset + 1, 4) == 2);
+        }
+    }
+}
+
+/**
+ * @brief Read a job list from text, returns the error message if it is
+ * rejected.
+ */
+static std::string parse_job_list(const std::string& text, std::vector<RunnerJob>& jobs) {
+    {
+        std::ofstream file("test_jobs.txt", std::ios_base::trunc);
+        file << text;
+    }
+
+    std::string error;
+
+    try {
+        jobs = read_job_list("test_jobs.txt");
+    } catch (const std::runtime_error& e) {
+        error = e.what();
+    }
+
+    std::remove("test_jobs.txt");
+
+    return error;
+}
+
+static void test_job_list(const std::vector<uint8_t>&) {
+    std::vector<RunnerJob> jobs;
+
+    std::string error = parse_job_list(
+        "# rom frames seed movie quirks\n"
+        "\n"
+        "a.ch8 600\n"
+        "b.ch8 3600 42 movie.txt\n"
+        "c.ch8 1 4294967295 - wrap\n", jobs);
+
+    if (!CHECK(error.empty()) || !CHECK(jobs.size() == 3)) {
+        return;
+    }
+
+    CHECK(jobs[0].rom_path == "a.ch8" && jobs[0].frames == 600 && jobs[0].seed == 1);
+    CHECK(jobs[0].movie_path.empty() && !jobs[0].quirks.wrap_sprites);
+    CHECK(jobs[1].frames == 3600 && jobs[1].seed == 42 && jobs[1].movie_path == "movie.txt");
+    CHECK(jobs[2].seed == 4294967295u && jobs[2].movie_path.empty() && jobs[2].quirks.wrap_sprites);
+
+    // Rejected lines, reported with their line number.
+    const char* bad_lines[] = {
+        "a.ch8",
+        "a.ch8 0",
+        "a.ch8 12x",
+        "a.ch8 -5",
+        "a.ch8 600 4294967296",
+        "a.ch8 600 -1",
+        "a.ch8 600 1 - fast",
+        "a.ch8 600 1 - wrap extra",
+    };
+
+    for (const char* line : bad_lines) {
+        error = parse_job_list(std::format("# header\na.ch8 600\n{}\n", line), jobs);
+
+        if (!CHECK(error.starts_with("test_jobs.txt:3: "))) {
+            std::cerr << std::format("\"{}\" gave \"{}\"", line, error) << std::endl;
+        }
+    }
+}
+
+struct Test {
+    const char* name;
+    void (*run)(const std::vector<uint8_t>& rom);
+};
+
+static const Test TESTS[] = {
+    {"predecode", test_predecode},
+    {"batch", test_batch},
+    {"rewind", test_rewind},
+    {"hash", test_hash},
+    {"wav", test_wav},
+    {"video", test_video},
+    {"job_list", test_job_list},
+};
+
+/**
+ * @brief Run one test: chip8_tests <test> <training_rom>. Scratch files are
+ * written to the current directory and deleted again.
+ */
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: chip8_tests <test> <training_rom>" << std::endl;
+        return 1;
+    }
+
+    std::vector<uint8_t> rom;
+    if (!read_binary_file(argv[2], rom)) {
+        std::cerr << "Could not read ROM." << std::endl;
+        return 1;
+    }
+
+    for (const Test& test : TESTS) {
+        if (std::string(argv[1]) == test.name) {
+            test.run(rom);
+
+            std::cout << std::format("{}: {}", test.name, g_failures == 0 ? "passed" : "FAILED") << std::endl;
+
+            return g_failures == 0 ? 0 : 1;
+        }
+    }
+
+    std::cerr << "Unknown test: " << argv[1] << std::endl;
+
+    return 1;
+}